@@ -0,0 +1,165 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <pthread.h>        // For touching the arena in parallel
+#include <sys/mman.h>       // For huge page backed arenas
+
+#include "sim.h"
+
+
+int CreateArena(Arena *arena, size_t size)
+{
+    memset(arena, 0, sizeof(*arena));
+
+    // Reserved huge pages when the system has some
+    size_t hugeSize = (size + ARENA_HUGE_PAGE - 1)/ARENA_HUGE_PAGE*ARENA_HUGE_PAGE;
+#ifdef MAP_HUGETLB
+    void *base = mmap(NULL, hugeSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (base != MAP_FAILED)
+    {
+        arena->base = base;
+        arena->size = hugeSize;
+        arena->hugePages = 1;
+        return 0;
+    }
+#endif
+
+    // Otherwise normal pages on a huge page boundary, so transparent huge pages can back all of it
+    uint8_t *mapping = mmap(NULL, hugeSize + ARENA_HUGE_PAGE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED)
+    {
+        printf("Could not map %zu bytes of simulation state\n", size);
+        return -1;
+    }
+
+    uint8_t *aligned = (uint8_t *)(((uintptr_t)mapping + ARENA_HUGE_PAGE - 1)/ARENA_HUGE_PAGE*ARENA_HUGE_PAGE);
+    if (aligned > mapping)
+    {
+        munmap(mapping, aligned - mapping);
+    }
+    munmap(aligned + hugeSize, mapping + ARENA_HUGE_PAGE - aligned);
+#ifdef MADV_HUGEPAGE
+    madvise(aligned, hugeSize, MADV_HUGEPAGE);
+#endif
+
+    arena->base = aligned;
+    arena->size = hugeSize;
+    return 0;
+}
+
+void DestroyArena(Arena *arena)
+{
+    if (arena->base != NULL)
+    {
+        munmap(arena->base, arena->size);
+    }
+    memset(arena, 0, sizeof(*arena));
+}
+
+void *ArenaAlloc(Arena *arena, size_t size)
+{
+    // Without memory only the size is added up, for sizing the real arena
+    size_t start = (arena->used + ARENA_ALIGN - 1)/ARENA_ALIGN*ARENA_ALIGN;
+    if (arena->count == ARENA_MAX_ALLOCATIONS || (arena->base != NULL && start + size > arena->size))
+    {
+        return NULL;
+    }
+
+    arena->offsets[arena->count] = start;
+    arena->sizes[arena->count] = size;
+    arena->count++;
+    arena->used = start + size;
+    return arena->base != NULL ? arena->base + start : NULL;
+}
+
+size_t HugePageBoundary(size_t offset)
+{
+    // Closest huge page boundary, the arena starts on one
+    return (offset + ARENA_HUGE_PAGE/2)/ARENA_HUGE_PAGE*ARENA_HUGE_PAGE;
+}
+
+void *TouchArena(void *data)
+{
+    // Same fraction of every allocation, so a thread owning agents or rows [k/n, (k+1)/n) wrote them first.
+    // A page lands on one node as a whole, so the fractions are moved to huge page boundaries
+    // and allocations smaller than a huge page end up with a single thread
+    const ArenaPart *part = data;
+    const Arena *arena = part->arena;
+    for (int a = 0; a < arena->count; a++)
+    {
+        size_t begin = arena->offsets[a], end = begin + arena->sizes[a];
+        size_t start = part->part == 0 ? begin : HugePageBoundary(begin + arena->sizes[a]*part->part/part->parts);
+        size_t stop = part->part + 1 == part->parts ? end :
+                      HugePageBoundary(begin + arena->sizes[a]*(part->part + 1)/part->parts);
+
+        start = MIN(end, MAX(begin, start));
+        stop = MIN(end, MAX(begin, stop));
+        if (start < stop)
+        {
+            memset(arena->base + start, 0, stop - start);
+        }
+    }
+    return NULL;
+}
+
+void ResetArena(Arena *arena, int parts)
+{
+    // Allocations stay where they are, their contents go back to zero.
+    // Untouched pages are placed on the node of the thread that clears them
+    parts = MAX(1, parts);
+    ArenaPart ranges[parts];
+    pthread_t workers[parts];
+    int started[parts];
+
+    for (int t = 0; t < parts; t++)
+    {
+        ranges[t] = (ArenaPart){arena, t, parts};
+        started[t] = t > 0 && pthread_create(&workers[t], NULL, TouchArena, &ranges[t]) == 0;
+        if (t > 0 && !started[t])
+        {
+            TouchArena(&ranges[t]);
+        }
+    }
+    TouchArena(&ranges[0]);
+
+    for (int t = 1; t < parts; t++)
+    {
+        if (started[t])
+        {
+            pthread_join(workers[t], NULL);
+        }
+    }
+}
+
+int CountHugePages(const Arena *arena)
+{
+    if (arena->hugePages)
+    {
+        return arena->size/ARENA_HUGE_PAGE;
+    }
+
+    // Transparent ones are up to the kernel, the arena's mapping in smaps says how many it gave
+    FILE *file = fopen("/proc/self/smaps", "r");
+    if (file == NULL)
+    {
+        return 0;
+    }
+
+    char line[256];
+    int inArena = 0, hugePages = 0;
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        unsigned long start, end, kB;
+        if (sscanf(line, "%lx-%lx ", &start, &end) == 2)
+        {
+            inArena = start < (uintptr_t)arena->base + arena->size && end > (uintptr_t)arena->base;
+        }
+        else if (inArena && sscanf(line, "AnonHugePages: %lu kB", &kB) == 1)
+        {
+            hugePages += kB*1024/ARENA_HUGE_PAGE;
+        }
+    }
+
+    fclose(file);
+    return hugePages;
+}
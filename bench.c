@@ -0,0 +1,97 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "sim.h"
+
+
+#define BENCH_WARMUP 50       // Steps before timing, so the field has trails
+#define BENCH_STEPS 100
+#define BENCH_DIFFUSE_STEPS 10
+
+
+double TimeKernel(AgentKernel kernel)
+{
+    uint64_t start = Ticks();
+    for (int step = 0; step < BENCH_STEPS; step++)
+    {
+        kernel(0, N_AGENTS, steeringStrengths, DEFAULT_DELTA_TIME, newXPos, newYPos);
+    }
+    return 1000.0*(Ticks() - start)/TICKS_PER_SECOND/BENCH_STEPS;
+}
+
+int main(void)
+{
+    printf("Agent kernel: %s\n", SelectAgentKernel());
+
+    // Everything a run needs, allocated once
+    if (CreateState() != 0)
+    {
+        return -1;
+    }
+
+    SeedRandom(1);
+    CreateGrid();
+    Spawn("circle");
+
+    for (int step = 0; step < BENCH_WARMUP; step++)
+    {
+        Update(DEFAULT_DELTA_TIME);
+    }
+
+    // Whole steps, split into phases by the stats counters
+    memset(&stats, 0, sizeof(stats));
+    uint64_t start = Ticks();
+    for (int step = 0; step < BENCH_STEPS; step++)
+    {
+        Update(DEFAULT_DELTA_TIME);
+    }
+    double stepMs = 1000.0*(Ticks() - start)/TICKS_PER_SECOND/BENCH_STEPS;
+
+    printf("step     %8.3f ms  %.0f agent steps/s\n", stepMs, N_AGENTS/(stepMs/1000));
+    printf(" agents  %8.3f ms\n", 1000.0*stats.agentTime/TICKS_PER_SECOND/BENCH_STEPS);
+    printf(" blur    %8.3f ms\n", 1000.0*stats.blurTime/TICKS_PER_SECOND/BENCH_STEPS);
+    printf(" reset   %8.3f ms\n", 1000.0*stats.resetTime/TICKS_PER_SECOND/BENCH_STEPS);
+
+    // Agent kernels on their own, angles restored so every kernel sees the same agents
+    static float angles[N_AGENTS];
+    memcpy(angles, agents.angle, sizeof(angles));
+
+    printf("kernel scalar %8.3f ms\n", TimeKernel(AgentKernelScalar));
+    memcpy(agents.angle, angles, sizeof(angles));
+#if defined(__x86_64__) || defined(__i386__)
+    if (__builtin_cpu_supports("sse2"))
+    {
+        printf("kernel sse2   %8.3f ms\n", TimeKernel(AgentKernelSSE));
+        memcpy(agents.angle, angles, sizeof(angles));
+    }
+    if (__builtin_cpu_supports("avx2"))
+    {
+        printf("kernel avx2   %8.3f ms\n", TimeKernel(AgentKernelAVX2));
+        memcpy(agents.angle, angles, sizeof(angles));
+    }
+#endif
+
+    // Direct against FFT diffusion by radius, where they cross sets DIFFUSION_FFT_RADIUS
+    static float field[GRID_SIZE];
+    for (int radius = 2; radius <= MAX_DIFFUSION_RADIUS; radius *= 2)
+    {
+        char spec[32];
+        double ms[2];
+        for (int method = 0; method < 2; method++)
+        {
+            snprintf(spec, sizeof(spec), "gauss:%d@%s", radius, method ? "fft" : "direct");
+            SetDiffusion(spec);
+
+            uint64_t start = Ticks();
+            for (int step = 0; step < BENCH_DIFFUSE_STEPS; step++)
+            {
+                Diffuse(grid, field);
+            }
+            ms[method] = 1000.0*(Ticks() - start)/TICKS_PER_SECOND/BENCH_DIFFUSE_STEPS;
+        }
+        printf("diffuse gauss:%-3d direct %8.3f ms  fft %8.3f ms\n", radius, ms[0], ms[1]);
+    }
+    SetDiffusion("box8");
+
+    return 0;
+}
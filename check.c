@@ -0,0 +1,326 @@
+#include <stdlib.h>
+#include <string.h>         // For comparing golden names
+
+#include "sim.h"
+
+
+// Check Values
+#define CHECK_SEED 1
+#define CHECK_SAMPLES 1000      // Sensor reads and tail pushes per scenario
+#define CHECK_STEPS 200         // Full updates in the run scenario
+#define CHECK_BATCH 8           // Steps per UpdateSteps call in the batch scenario
+#define CHECK_LONG_STEPS 20     // Updates of each length in the long step scenario
+#define CHECK_LONG_DELTA_TIME 200   // Split into sub-steps of a tile, 10x that also runs out of sub-steps
+#define CHECK_MAX_SCENARIOS 32
+
+typedef uint64_t (*Scenario)();
+
+
+void FillPattern()
+{
+    // Field with structure in every direction, no agents involved
+    CreateGrid();
+    for (int y = 0; y < ROWS; y++)
+    {
+        for (int x = 0; x < COLUMNS; x++)
+        {
+            uint8_t bw = (x*7 + y*13 + (x*y) % 31) & 255;
+            grid[y*COLUMNS + x].bw = bw;
+            tempGrid[y*COLUMNS + x].bw = bw;
+        }
+    }
+}
+
+void WalkTails(int length)
+{
+    // Every agent gets a tail as if it had walked towards its position
+    for (int i = 0; i < N_AGENTS; i++)
+    {
+        for (int j = 0; j < length; j++)
+        {
+            float x = MIN(COLUMNS - 1, MAX(0, agents.xPos[i] - j*agents.speed[i]*20));
+            float y = MIN(ROWS - 1, MAX(0, agents.yPos[i] + j*agents.speed[i]*10));
+            UpdateTail(agents.xPrev[i], agents.yPrev[i], x, y);
+        }
+    }
+}
+
+uint64_t ScenarioSense()
+{
+    FillPattern();
+    SeedRandom(CHECK_SEED);
+
+    static float weights[CHECK_SAMPLES];
+    for (int k = 0; k < CHECK_SAMPLES; k++)
+    {
+        float x = Rand01()*COLUMNS;
+        float y = Rand01()*ROWS;
+        float angle = 2*M_PI*Rand01();
+        weights[k] = Sense(x, y, angle, params.sensorScope*(k % 3 - 1));
+    }
+    return HashWords(HASH_SEED, weights, sizeof(weights));
+}
+
+uint64_t ScenarioUpdateTail()
+{
+    float xPrev[TAIL_LENGTH], yPrev[TAIL_LENGTH];
+    for (int j = 0; j < TAIL_LENGTH; j++)
+    {
+        xPrev[j] = -1;
+        yPrev[j] = -1;
+    }
+
+    // More pushes than the tail holds so the oldest ones fall off
+    for (int k = 0; k < CHECK_SAMPLES; k++)
+    {
+        UpdateTail(xPrev, yPrev, k*0.5f, -k*0.25f);
+    }
+
+    uint64_t hash = HashWords(HASH_SEED, xPrev, sizeof(xPrev));
+    return HashWords(hash, yPrev, sizeof(yPrev));
+}
+
+uint64_t ScenarioChangeShadeBlur()
+{
+    CreateGrid();
+    SeedRandom(CHECK_SEED);
+
+    // Repeated tiles keep the brightest shade
+    for (int k = 0; k < 100*CHECK_SAMPLES; k++)
+    {
+        int i = Random() % (GRID_SIZE);
+        ChangeShadeBlur(i, Random() % 256);
+    }
+    return HashWords(HASH_SEED, tempGrid, sizeof(Tile)*(GRID_SIZE));
+}
+
+uint64_t ScenarioBlur()
+{
+    FillPattern();
+    SeedRandom(CHECK_SEED);
+    Spawn("random");
+    WalkTails(TAIL_LENGTH/10);
+
+    Blur(DEFAULT_DELTA_TIME);
+    return HashWords(HASH_SEED, tempGrid, sizeof(Tile)*(GRID_SIZE));
+}
+
+uint64_t BlurWith(const char *kernel)
+{
+    SetDiffusion(kernel);
+    uint64_t hash = ScenarioBlur();
+    SetDiffusion("box8");
+    return hash;
+}
+
+uint64_t ScenarioBlurBox3()    { return BlurWith("box3"); }
+uint64_t ScenarioBlurGauss5()  { return BlurWith("gauss5"); }
+uint64_t ScenarioBlurGauss()   { return BlurWith("gauss:6"); }
+uint64_t ScenarioBlurAniso()   { return BlurWith("aniso:4,1"); }
+uint64_t ScenarioBlurLine()    { return BlurWith("line:30,3"); }
+
+uint64_t ScenarioAgentUpdate()
+{
+    FillPattern();
+    SeedRandom(CHECK_SEED);
+    Spawn("random");
+
+    // Agents only, the field is left as it is between steps
+    for (int step = 0; step < 10; step++)
+    {
+        AgentUpdate(DEFAULT_DELTA_TIME);
+    }
+
+    uint64_t hash = HashState();
+    return HashWords(hash, tempGrid, sizeof(Tile)*(GRID_SIZE));
+}
+
+uint64_t ScenarioRun()
+{
+    SeedRandom(CHECK_SEED);
+    CreateGrid();
+    Spawn("circle");
+
+    for (int step = 0; step < CHECK_STEPS; step++)
+    {
+        Update(DEFAULT_DELTA_TIME);
+    }
+    return HashState();
+}
+
+uint64_t ScenarioBatch()
+{
+    // The run scenario in batches, has to give the same hash as run
+    SeedRandom(CHECK_SEED);
+    CreateGrid();
+    Spawn("circle");
+
+    for (int step = 0; step < CHECK_STEPS; step += CHECK_BATCH)
+    {
+        UpdateSteps(DEFAULT_DELTA_TIME, MIN(CHECK_BATCH, CHECK_STEPS - step));
+    }
+    return HashState();
+}
+
+uint64_t ScenarioLongSteps()
+{
+    // Sub-stepped updates, then ones capped at AGENT_MAX_SUBSTEPS whose moves DepositSegment fills in
+    SeedRandom(CHECK_SEED);
+    CreateGrid();
+    Spawn("circle");
+
+    for (int step = 0; step < CHECK_LONG_STEPS; step++)
+    {
+        Update(CHECK_LONG_DELTA_TIME);
+    }
+    for (int step = 0; step < CHECK_LONG_STEPS; step++)
+    {
+        Update(10*CHECK_LONG_DELTA_TIME);
+    }
+    return HashState();
+}
+
+uint64_t RunWithDeposit(const char *spec)
+{
+    SetDeposit(spec);
+    uint64_t hash = ScenarioRun();
+    SetDeposit("tile:255");
+    return hash;
+}
+
+uint64_t ScenarioDepositAdd()   { return RunWithDeposit("add:40"); }
+uint64_t ScenarioDepositSplat() { return RunWithDeposit("splat:80"); }
+
+const uint8_t *AttractStripes()
+{
+    static uint8_t attract[GRID_SIZE + 4];
+    for (int y = 0; y < ROWS; y++)
+    {
+        for (int x = 0; x < COLUMNS; x++)
+        {
+            attract[y*COLUMNS + x] = (x/8) % 2 ? 60 : 0;
+        }
+    }
+    return attract;
+}
+
+uint64_t ScenarioMaps()
+{
+    // Attractor stripes and an obstacle bar across the middle
+    static uint8_t obstacles[GRID_SIZE + 4];
+    for (int y = 0; y < ROWS; y++)
+    {
+        for (int x = 0; x < COLUMNS; x++)
+        {
+            obstacles[y*COLUMNS + x] = (y > ROWS/2 - 4 && y < ROWS/2 + 4 && x > COLUMNS/4) ? 255 : 0;
+        }
+    }
+    attractMap = (MapLayer){AttractStripes(), NULL, 0};
+    obstacleMap = (MapLayer){obstacles, NULL, 0};
+
+    uint64_t hash = ScenarioRun();
+
+    attractMap = (MapLayer){NULL, NULL, 0};
+    obstacleMap = (MapLayer){NULL, NULL, 0};
+    return hash;
+}
+
+uint64_t ScenarioMipSense()
+{
+    // Pyramid sensing forced on at the default sensor size, the pyramids follow a field the agents change
+    senseMip = 1;
+    attractMap = (MapLayer){AttractStripes(), NULL, 0};
+
+    uint64_t hash = ScenarioRun();
+
+    attractMap = (MapLayer){NULL, NULL, 0};
+    senseMip = SENSOR_SIZE >= MIP_SENSE_SIZE;
+    return hash;
+}
+
+int CheckGolden(const char *path, int write)
+{
+    struct { const char *name; Scenario scenario; int perKernel; } scenarios[] = {
+        {"sense",             ScenarioSense,           0},
+        {"update_tail",       ScenarioUpdateTail,      0},
+        {"change_shade_blur", ScenarioChangeShadeBlur, 0},
+        {"blur",              ScenarioBlur,            0},
+        {"blur_box3",         ScenarioBlurBox3,        0},
+        {"blur_gauss5",       ScenarioBlurGauss5,      0},
+        {"blur_gauss",        ScenarioBlurGauss,       0},
+        {"blur_aniso",        ScenarioBlurAniso,       0},
+        {"blur_line",         ScenarioBlurLine,        0},
+        {"agent_update",      ScenarioAgentUpdate,     1},
+        {"run",               ScenarioRun,             1},
+        {"batch",             ScenarioBatch,           1},
+        {"long_steps",        ScenarioLongSteps,       1},
+        {"maps",              ScenarioMaps,            1},
+        {"deposit_add",       ScenarioDepositAdd,      1},
+        {"deposit_splat",     ScenarioDepositSplat,    1},
+        {"mip_sense",         ScenarioMipSense,        0},
+    };
+    int nScenarios = sizeof(scenarios)/sizeof(scenarios[0]);
+    const char *kernels[] = {"scalar", "sse2", "avx2"};
+
+    // Golden hashes, one "name hash" per line
+    char names[CHECK_MAX_SCENARIOS][64];
+    unsigned long long golden[CHECK_MAX_SCENARIOS];
+    int nGolden = 0;
+
+    FILE *file = fopen(path, write ? "w" : "r");
+    if (file == NULL)
+    {
+        printf("Could not open %s\n", path);
+        return -1;
+    }
+    while (!write && nGolden < CHECK_MAX_SCENARIOS &&
+           fscanf(file, "%63s %llx", names[nGolden], &golden[nGolden]) == 2)
+    {
+        nGolden++;
+    }
+
+    int failed = 0;
+    for (int s = 0; s < nScenarios; s++)
+    {
+        // Every kernel has to reproduce the scalar hash exactly
+        uint64_t reference = 0;
+        for (int k = 0; k < (scenarios[s].perKernel ? 3 : 1); k++)
+        {
+            if (UseAgentKernel(kernels[k]) != 0)
+            {
+                printf("%-18s %-6s not supported\n", scenarios[s].name, kernels[k]);
+                continue;
+            }
+
+            uint64_t hash = scenarios[s].scenario();
+            int ok;
+
+            if (write)
+            {
+                // New goldens come from the scalar kernel
+                if (k == 0)
+                {
+                    reference = hash;
+                    fprintf(file, "%s %016llx\n", scenarios[s].name, (unsigned long long)hash);
+                }
+                ok = hash == reference;
+            }
+            else
+            {
+                int g = 0;
+                while (g < nGolden && strcmp(names[g], scenarios[s].name) != 0)
+                {
+                    g++;
+                }
+                ok = g < nGolden && golden[g] == hash;
+            }
+
+            failed += !ok;
+            printf("%-18s %-6s %016llx %s\n", scenarios[s].name, kernels[k], (unsigned long long)hash, ok ? "ok" : "FAILED");
+        }
+    }
+
+    fclose(file);
+    SelectAgentKernel();
+    return failed ? -1 : 0;
+}
@@ -0,0 +1,89 @@
+# Profile guided build: instrumented build, canned training run, rebuild
+# with the profile, then the same workload timed against plain Release.
+#
+# Run through the pgo target, which passes SOURCE_DIR, WORK_DIR,
+# C_COMPILER, C_COMPILER_ID and MARCH.
+
+set(TRAIN_ARGS --seed 1 --steps 300)    # Training workload
+set(BENCH_ARGS --seed 2 --steps 300)    # Timed workload, different seed
+set(BENCH_RUNS 3)                       # Best of
+
+set(PROFILE_DIR "${WORK_DIR}/profile")
+
+function(configure_and_build dir pgo)
+    execute_process(
+        COMMAND ${CMAKE_COMMAND} -S "${SOURCE_DIR}" -B "${dir}"
+                -DCMAKE_BUILD_TYPE=Release
+                "-DCMAKE_C_COMPILER=${C_COMPILER}"
+                "-DSLIME_MARCH=${MARCH}"
+                -DSLIME_PGO=${pgo}
+                "-DSLIME_PGO_DIR=${PROFILE_DIR}"
+        RESULT_VARIABLE result)
+    if(NOT result EQUAL 0)
+        message(FATAL_ERROR "Configuring ${dir} with SLIME_PGO=${pgo} failed")
+    endif()
+
+    execute_process(COMMAND ${CMAKE_COMMAND} --build "${dir}" RESULT_VARIABLE result)
+    if(NOT result EQUAL 0)
+        message(FATAL_ERROR "Building ${dir} with SLIME_PGO=${pgo} failed")
+    endif()
+endfunction()
+
+function(time_workload binary out)
+    set(best "")
+    foreach(run RANGE 1 ${BENCH_RUNS})
+        execute_process(COMMAND "${binary}" ${BENCH_ARGS} OUTPUT_VARIABLE output RESULT_VARIABLE result)
+        if(NOT result EQUAL 0 OR NOT output MATCHES "steps in ([0-9]+)\\.([0-9]+) s")
+            message(FATAL_ERROR "Workload failed for ${binary}")
+        endif()
+
+        # Milliseconds, CMake math is integer only
+        math(EXPR ms "${CMAKE_MATCH_1} * 1000 + ${CMAKE_MATCH_2}")
+        if(best STREQUAL "" OR ms LESS best)
+            set(best ${ms})
+        endif()
+    endforeach()
+    set(${out} ${best} PARENT_SCOPE)
+endfunction()
+
+# Instrumented build and training run
+file(REMOVE_RECURSE "${PROFILE_DIR}")
+configure_and_build("${WORK_DIR}/pgo" GENERATE)
+
+message(STATUS "Training: slime-headless ${TRAIN_ARGS}")
+execute_process(COMMAND "${WORK_DIR}/pgo/slime-headless" ${TRAIN_ARGS} RESULT_VARIABLE result)
+if(NOT result EQUAL 0)
+    message(FATAL_ERROR "Training run failed")
+endif()
+
+# Clang writes raw profiles that have to be merged first
+if(C_COMPILER_ID MATCHES "Clang")
+    find_program(LLVM_PROFDATA NAMES llvm-profdata)
+    if(LLVM_PROFDATA)
+        set(profdata "${LLVM_PROFDATA}")
+    else()
+        set(profdata xcrun llvm-profdata)
+    endif()
+    file(GLOB raw "${PROFILE_DIR}/*.profraw")
+    execute_process(COMMAND ${profdata} merge -output=${PROFILE_DIR}/default.profdata ${raw} RESULT_VARIABLE result)
+    if(NOT result EQUAL 0)
+        message(FATAL_ERROR "Merging profiles failed")
+    endif()
+endif()
+
+# Same build directory, so GCC finds the profiles for each object
+configure_and_build("${WORK_DIR}/pgo" USE)
+configure_and_build("${WORK_DIR}/release" OFF)
+
+time_workload("${WORK_DIR}/release/slime-headless" release)
+time_workload("${WORK_DIR}/pgo/slime-headless" pgo)
+
+math(EXPR speedup "100 * ${release} / ${pgo}")
+math(EXPR whole "${speedup} / 100")
+math(EXPR fraction "${speedup} % 100")
+if(fraction LESS 10)
+    set(fraction "0${fraction}")
+endif()
+
+message(STATUS "Release: ${release} ms, PGO: ${pgo} ms, speedup ${whole}.${fraction}x")
+message(STATUS "PGO binaries are in ${WORK_DIR}/pgo")
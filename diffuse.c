@@ -0,0 +1,459 @@
+#include <stdlib.h>
+#include <string.h>         // For parsing kernel specs
+
+#include "sim.h"
+
+
+Diffusion diffusion = {"box8", DIFFUSION_BOX8};
+
+// Per step scratch in the state arena, rows are padded with zeros so taps need no bounds checks
+float *diffusionRows;
+float diffusionPadded[COLUMNS + 2*MAX_DIFFUSION_RADIUS];
+int *diffusionSums;
+
+// Frequency domain kernels, real because the weights are symmetric
+int fftSizeX;
+int fftSizeY;
+float fftKernelX[FFT_MAX_SIZE];
+float fftKernelY[FFT_MAX_SIZE];
+float fftRe[FFT_MAX_SIZE];
+float fftIm[FFT_MAX_SIZE];
+float fftCos[FFT_MAX_SIZE/2];
+float fftSin[FFT_MAX_SIZE/2];
+int fftTwiddleSize;
+
+
+void CarveDiffusion(Arena *arena)
+{
+    diffusionRows = ArenaAlloc(arena, sizeof(float)*(GRID_SIZE));
+    diffusionSums = ArenaAlloc(arena, sizeof(int)*(GRID_SIZE));
+}
+
+void GaussWeights(int radius, float *weights)
+{
+    // Sigma of half the radius keeps the tails small but not negligible
+    float sigma = MAX(0.5f, radius/2.0f);
+    for (int k = -radius; k <= radius; k++)
+    {
+        weights[k + radius] = expf(-(k*k)/(2*sigma*sigma));
+    }
+}
+
+void EdgeNorms(const float *weights, int radius, int size, float *norms)
+{
+    // Kernel weight that lands inside the grid, so edges are not darkened
+    for (int x = 0; x < size; x++)
+    {
+        float total = 0;
+        for (int k = -radius; k <= radius; k++)
+        {
+            if (x + k >= 0 && x + k < size)
+            {
+                total += weights[k + radius];
+            }
+        }
+        norms[x] = 1/total;
+    }
+}
+
+void FFT(float *re, float *im, int size, int inverse)
+{
+    // Iterative radix 2, twiddles are shared by every size up to fftTwiddleSize
+    for (int i = 1, j = 0; i < size; i++)
+    {
+        int bit = size >> 1;
+        for (; j & bit; bit >>= 1)
+        {
+            j ^= bit;
+        }
+        j ^= bit;
+
+        if (i < j)
+        {
+            float t = re[i]; re[i] = re[j]; re[j] = t;
+            t = im[i]; im[i] = im[j]; im[j] = t;
+        }
+    }
+
+    for (int length = 2; length <= size; length <<= 1)
+    {
+        // Each twiddle once per stage, applied to every block
+        int half = length/2;
+        int stride = fftTwiddleSize/length;
+        for (int k = 0; k < half; k++)
+        {
+            float wr = fftCos[k*stride];
+            float wi = inverse ? fftSin[k*stride] : -fftSin[k*stride];
+
+            for (int a = k; a < size; a += length)
+            {
+                int b = a + half;
+                float tr = re[b]*wr - im[b]*wi;
+                float ti = re[b]*wi + im[b]*wr;
+
+                re[b] = re[a] - tr;
+                im[b] = im[a] - ti;
+                re[a] += tr;
+                im[a] += ti;
+            }
+        }
+    }
+}
+
+int FFTSize(int length, int radius)
+{
+    // Room for the line and the kernel tail so nothing wraps into the result
+    int size = 1;
+    while (size < length + radius)
+    {
+        size <<= 1;
+    }
+    return size;
+}
+
+void FFTKernel(const float *weights, int radius, int size, float *kernel)
+{
+    // Weights centred on index 0, wrapping around for negative taps
+    memset(fftRe, 0, sizeof(float)*size);
+    memset(fftIm, 0, sizeof(float)*size);
+    for (int k = -radius; k <= radius; k++)
+    {
+        fftRe[(k + size) % size] = weights[k + radius];
+    }
+
+    FFT(fftRe, fftIm, size, 0);
+
+    // Inverse transform scaling folded in
+    for (int f = 0; f < size; f++)
+    {
+        kernel[f] = fftRe[f]/size;
+    }
+}
+
+void PrepareFFT()
+{
+    if (fftTwiddleSize == 0)
+    {
+        fftTwiddleSize = FFT_MAX_SIZE;
+        for (int k = 0; k < FFT_MAX_SIZE/2; k++)
+        {
+            fftCos[k] = cos(2*M_PI*k/FFT_MAX_SIZE);
+            fftSin[k] = sin(2*M_PI*k/FFT_MAX_SIZE);
+        }
+    }
+
+    fftSizeX = FFTSize(COLUMNS, diffusion.radiusX);
+    fftSizeY = FFTSize(ROWS, diffusion.radiusY);
+    FFTKernel(diffusion.weightsX, diffusion.radiusX, fftSizeX, fftKernelX);
+    FFTKernel(diffusion.weightsY, diffusion.radiusY, fftSizeY, fftKernelY);
+}
+
+void ConvolvePair(int size, const float *kernel)
+{
+    // Two real lines in one complex transform, the kernel is real so they stay apart
+    FFT(fftRe, fftIm, size, 0);
+    for (int f = 0; f < size; f++)
+    {
+        fftRe[f] *= kernel[f];
+        fftIm[f] *= kernel[f];
+    }
+    FFT(fftRe, fftIm, size, 1);
+}
+
+int SetDiffusion(const char *spec)
+{
+    Diffusion next = {"", DIFFUSION_SEPARABLE};
+    snprintf(next.name, sizeof(next.name), "%s", spec);
+
+    // Optional @fft or @direct, otherwise whichever measures faster
+    int method = DIFFUSION_AUTO;
+    char *at = strchr(next.name, '@');
+    if (at != NULL)
+    {
+        method = strcmp(at, "@fft") == 0 ? DIFFUSION_FFT : (strcmp(at, "@direct") == 0 ? DIFFUSION_DIRECT : -1);
+        *at = 0;
+        if (method < 0)
+        {
+            printf("Unknown diffusion method %s\n", at + 1);
+            return -1;
+        }
+    }
+    spec = next.name;
+
+    int radiusX, radiusY;
+    float degrees;
+
+    if (strcmp(spec, "box8") == 0)
+    {
+        // 8 neighbours over 9, the original blur
+        next.type = DIFFUSION_BOX8;
+    }
+    else if (strcmp(spec, "box3") == 0)
+    {
+        next.radiusX = next.radiusY = 1;
+        for (int k = 0; k < 3; k++)
+        {
+            next.weightsX[k] = next.weightsY[k] = 1;
+        }
+    }
+    else if (strcmp(spec, "gauss5") == 0)
+    {
+        const float binomial[5] = {1, 4, 6, 4, 1};
+        next.radiusX = next.radiusY = 2;
+        memcpy(next.weightsX, binomial, sizeof(binomial));
+        memcpy(next.weightsY, binomial, sizeof(binomial));
+    }
+    else if (sscanf(spec, "gauss:%d", &radiusX) == 1 && radiusX >= 0 && radiusX <= MAX_DIFFUSION_RADIUS)
+    {
+        next.radiusX = next.radiusY = radiusX;
+        GaussWeights(radiusX, next.weightsX);
+        GaussWeights(radiusX, next.weightsY);
+    }
+    else if (sscanf(spec, "aniso:%d,%d", &radiusX, &radiusY) == 2 &&
+             radiusX >= 0 && radiusX <= MAX_DIFFUSION_RADIUS && radiusY >= 0 && radiusY <= MAX_DIFFUSION_RADIUS)
+    {
+        // Different spread along each axis, still separable
+        next.radiusX = radiusX;
+        next.radiusY = radiusY;
+        GaussWeights(radiusX, next.weightsX);
+        GaussWeights(radiusY, next.weightsY);
+    }
+    else if (sscanf(spec, "line:%f,%d", &degrees, &radiusX) == 2 && radiusX >= 0 && radiusX <= MAX_DIFFUSION_RADIUS)
+    {
+        // Box along one direction, taps rounded to the closest tile
+        next.type = DIFFUSION_LINE;
+        next.radiusX = radiusX;
+        for (int k = -radiusX; k <= radiusX; k++)
+        {
+            next.tapX[k + radiusX] = lroundf(k*cosf(degrees*M_PI/180));
+            next.tapY[k + radiusX] = lroundf(k*sinf(degrees*M_PI/180));
+        }
+    }
+    else
+    {
+        printf("Unknown diffusion kernel %s\n", spec);
+        return -1;
+    }
+
+    if (next.type == DIFFUSION_SEPARABLE)
+    {
+        EdgeNorms(next.weightsX, next.radiusX, COLUMNS, next.normsX);
+        EdgeNorms(next.weightsY, next.radiusY, ROWS, next.normsY);
+    }
+
+    diffusion = next;
+
+    if (diffusion.type != DIFFUSION_SEPARABLE)
+    {
+        return 0;
+    }
+    PrepareFFT();
+
+    // Fixed crossover rather than a timing, so the same spec always rounds the same way
+    int radius = MAX(diffusion.radiusX, diffusion.radiusY);
+    if (method == DIFFUSION_AUTO)
+    {
+        method = radius >= DIFFUSION_FFT_RADIUS ? DIFFUSION_FFT : DIFFUSION_DIRECT;
+    }
+    diffusion.fft = method == DIFFUSION_FFT;
+    return 0;
+}
+
+void DiffuseBox8(const Tile *tiles, float *field)
+{
+    // Rows of 3, then columns of those, minus the centre, all in integers
+    for (int y = 0; y < ROWS; y++)
+    {
+        const Tile *row = &tiles[y*COLUMNS];
+        int *sums = &diffusionSums[y*COLUMNS];
+        for (int x = 0; x < COLUMNS; x++)
+        {
+            sums[x] = row[x].bw + (x > 0 ? row[x-1].bw : 0) + (x < COLUMNS - 1 ? row[x+1].bw : 0);
+        }
+    }
+
+    for (int y = 0; y < ROWS; y++)
+    {
+        const int *above = y > 0 ? &diffusionSums[(y-1)*COLUMNS] : NULL;
+        const int *below = y < ROWS - 1 ? &diffusionSums[(y+1)*COLUMNS] : NULL;
+        const int *sums = &diffusionSums[y*COLUMNS];
+
+        for (int x = 0; x < COLUMNS; x++)
+        {
+            int sum = sums[x] - tiles[y*COLUMNS + x].bw + (above ? above[x] : 0) + (below ? below[x] : 0);
+            field[y*COLUMNS + x] = (float)(sum)/9;
+        }
+    }
+}
+
+void DiffuseSeparable(const Tile *tiles, float *field)
+{
+    int radiusX = diffusion.radiusX;
+    int radiusY = diffusion.radiusY;
+
+    // Horizontal pass, tap outside and tile inside so each line vectorises
+    memset(diffusionPadded, 0, sizeof(diffusionPadded));
+    for (int y = 0; y < ROWS; y++)
+    {
+        float *row = &diffusionRows[y*COLUMNS];
+        for (int x = 0; x < COLUMNS; x++)
+        {
+            diffusionPadded[radiusX + x] = tiles[y*COLUMNS + x].bw;
+            row[x] = 0;
+        }
+
+        for (int k = 0; k <= 2*radiusX; k++)
+        {
+            float weight = diffusion.weightsX[k];
+            const float *taps = &diffusionPadded[k];
+            for (int x = 0; x < COLUMNS; x++)
+            {
+                row[x] += weight*taps[x];
+            }
+        }
+
+        for (int x = 0; x < COLUMNS; x++)
+        {
+            row[x] *= diffusion.normsX[x];
+        }
+    }
+
+    // Vertical pass over whole rows of the horizontal result
+    for (int y = 0; y < ROWS; y++)
+    {
+        float *out = &field[y*COLUMNS];
+        memset(out, 0, sizeof(float)*COLUMNS);
+
+        for (int k = MAX(-radiusY, -y); k <= MIN(radiusY, ROWS - 1 - y); k++)
+        {
+            float weight = diffusion.weightsY[k + radiusY];
+            const float *row = &diffusionRows[(y + k)*COLUMNS];
+            for (int x = 0; x < COLUMNS; x++)
+            {
+                out[x] += weight*row[x];
+            }
+        }
+
+        float norm = diffusion.normsY[y];
+        for (int x = 0; x < COLUMNS; x++)
+        {
+            out[x] *= norm;
+        }
+    }
+}
+
+void DiffuseFFT(const Tile *tiles, float *field)
+{
+    // Rows two at a time, same edge weights as the direct passes
+    for (int y = 0; y < ROWS; y += 2)
+    {
+        int pair = y + 1 < ROWS;
+        memset(fftRe + COLUMNS, 0, sizeof(float)*(fftSizeX - COLUMNS));
+        memset(fftIm + COLUMNS, 0, sizeof(float)*(fftSizeX - COLUMNS));
+        for (int x = 0; x < COLUMNS; x++)
+        {
+            fftRe[x] = tiles[y*COLUMNS + x].bw;
+            fftIm[x] = pair ? tiles[(y + 1)*COLUMNS + x].bw : 0;
+        }
+
+        ConvolvePair(fftSizeX, fftKernelX);
+
+        for (int x = 0; x < COLUMNS; x++)
+        {
+            diffusionRows[y*COLUMNS + x] = fftRe[x]*diffusion.normsX[x];
+            if (pair)
+            {
+                diffusionRows[(y + 1)*COLUMNS + x] = fftIm[x]*diffusion.normsX[x];
+            }
+        }
+    }
+
+    // Then columns two at a time
+    for (int x = 0; x < COLUMNS; x += 2)
+    {
+        int pair = x + 1 < COLUMNS;
+        memset(fftRe + ROWS, 0, sizeof(float)*(fftSizeY - ROWS));
+        memset(fftIm + ROWS, 0, sizeof(float)*(fftSizeY - ROWS));
+        for (int y = 0; y < ROWS; y++)
+        {
+            fftRe[y] = diffusionRows[y*COLUMNS + x];
+            fftIm[y] = pair ? diffusionRows[y*COLUMNS + x + 1] : 0;
+        }
+
+        ConvolvePair(fftSizeY, fftKernelY);
+
+        for (int y = 0; y < ROWS; y++)
+        {
+            // Rounding can leave tiny negatives where the field is empty
+            field[y*COLUMNS + x] = MAX(0, fftRe[y]*diffusion.normsY[y]);
+            if (pair)
+            {
+                field[y*COLUMNS + x + 1] = MAX(0, fftIm[y]*diffusion.normsY[y]);
+            }
+        }
+    }
+}
+
+void DiffuseLine(const Tile *tiles, float *field)
+{
+    // Not separable, but only 2*radius + 1 taps per tile
+    int taps = 2*diffusion.radiusX + 1;
+    for (int y = 0; y < ROWS; y++)
+    {
+        for (int x = 0; x < COLUMNS; x++)
+        {
+            int sum = 0;
+            int count = 0;
+            for (int k = 0; k < taps; k++)
+            {
+                int nx = x + diffusion.tapX[k];
+                int ny = y + diffusion.tapY[k];
+                if (nx >= 0 && nx < COLUMNS && ny >= 0 && ny < ROWS)
+                {
+                    sum += tiles[ny*COLUMNS + nx].bw;
+                    count++;
+                }
+            }
+            field[y*COLUMNS + x] = (float)sum/count;
+        }
+    }
+}
+
+void Diffuse(const Tile *tiles, float *field)
+{
+    switch (diffusion.type)
+    {
+        case DIFFUSION_BOX8:      DiffuseBox8(tiles, field); break;
+        case DIFFUSION_SEPARABLE:
+            if (diffusion.fft) DiffuseFFT(tiles, field);
+            else               DiffuseSeparable(tiles, field);
+            break;
+        case DIFFUSION_LINE:      DiffuseLine(tiles, field); break;
+    }
+}
+
+int CheckDiffusion()
+{
+    // Frequency domain against direct passes for a wide kernel on a structured field
+    for (int i = 0; i < GRID_SIZE; i++)
+    {
+        grid[i].bw = (i*7 + i/(COLUMNS)*13) & 255;
+    }
+
+    static float direct[GRID_SIZE], fft[GRID_SIZE];
+    SetDiffusion("gauss:24@direct");
+    Diffuse(grid, direct);
+    SetDiffusion("gauss:24@fft");
+    Diffuse(grid, fft);
+
+    float maxError = 0;
+    for (int i = 0; i < GRID_SIZE; i++)
+    {
+        maxError = MAX(maxError, fabsf(fft[i] - direct[i]));
+    }
+
+    SetDiffusion("box8");
+    int ok = maxError <= 1e-2f;
+    printf("fft    max error %g %s\n", maxError, ok ? "ok" : "FAILED");
+    return ok ? 0 : -1;
+}
@@ -0,0 +1,224 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "sim.h"
+
+
+#define HEADLESS_STEPS 1000
+
+
+void Usage(const char *name)
+{
+    printf("Usage: %s [--steps N] [--seed N] [--delta-time DT] [--out image.ppm] [--palette NAME]\n", name);
+    printf("       %*s [--trace trace.csv] [--trace-every N] [--kernel NAME]\n", (int)strlen(name), "");
+    printf("       %*s [--spawn PATTERN] [--attract map.pgm] [--obstacles map.pgm]\n", (int)strlen(name), "");
+    printf("       %*s [--food X,Y]... [--network network.txt] [--diffusion KERNEL]\n", (int)strlen(name), "");
+    printf("       %*s [--deposit tile|add|splat[:AMOUNT]]\n", (int)strlen(name), "");
+    printf("       %*s [--roi X,Y,W,H]... [--roi-every N] [--roi-log roi.csv] [--params params.txt]\n", (int)strlen(name), "");
+    printf("       %s --sweep spec.txt\n", name);
+    printf("       %s --check-kernels\n", name);
+    printf("       %s --check-golden golden.txt | --write-golden golden.txt\n", name);
+    printf("Spawn patterns:");
+    ListSpawnPatterns();
+    printf("Diffusion kernels: box8 box3 gauss5 gauss:R aniso:RX,RY line:DEGREES,R, separable ones take @fft or @direct\n");
+}
+
+int main(int argc, char *argv[])
+{
+    printf("Agent kernel: %s\n", SelectAgentKernel());
+
+    // Everything a run needs, allocated once
+    if (CreateState() != 0)
+    {
+        return -1;
+    }
+
+    // Kernels against the scalar reference, FFT diffusion against direct
+    if (argc == 2 && strcmp(argv[1], "--check-kernels") == 0)
+    {
+        int kernels = CheckKernels();
+        int diffusion = CheckDiffusion();
+        return kernels != 0 ? kernels : diffusion;
+    }
+
+    // Fixed scenarios against stored hashes
+    if (argc == 3 && strcmp(argv[1], "--check-golden") == 0)
+    {
+        return CheckGolden(argv[2], 0);
+    }
+    if (argc == 3 && strcmp(argv[1], "--write-golden") == 0)
+    {
+        return CheckGolden(argv[2], 1);
+    }
+
+    // Parameter sweep over worker processes
+    if (argc == 3 && strcmp(argv[1], "--sweep") == 0)
+    {
+        return RunSweep(argv[2]);
+    }
+
+    int steps = HEADLESS_STEPS;
+    double deltaTime = DEFAULT_DELTA_TIME;
+    unsigned int seed = 1;
+    const char *out = NULL;
+    int palette = 0;
+    const char *tracePath = NULL;
+    int traceEvery = TRACE_INTERVAL;
+    const char *spawn = "circle";
+    const char *network = NULL;
+    Roi rois[MAX_ROIS];
+    int roiCount = 0;
+    int roiEvery = ROI_INTERVAL;
+    const char *roiPath = ROI_FILE;
+    const char *paramsPath = NULL;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--steps") == 0 && i + 1 < argc)      steps = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc)  seed = strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--delta-time") == 0 && i + 1 < argc) deltaTime = atof(argv[++i]);
+        else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc)   out = argv[++i];
+        else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) tracePath = argv[++i];
+        else if (strcmp(argv[i], "--trace-every") == 0 && i + 1 < argc) traceEvery = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--spawn") == 0 && i + 1 < argc) spawn = argv[++i];
+        else if (strcmp(argv[i], "--network") == 0 && i + 1 < argc) network = argv[++i];
+        else if (strcmp(argv[i], "--roi-every") == 0 && i + 1 < argc) roiEvery = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--roi-log") == 0 && i + 1 < argc) roiPath = argv[++i];
+        else if (strcmp(argv[i], "--params") == 0 && i + 1 < argc) paramsPath = argv[++i];
+        else if (strcmp(argv[i], "--roi") == 0 && i + 1 < argc)
+        {
+            if (roiCount == MAX_ROIS)
+            {
+                printf("At most %d regions\n", MAX_ROIS);
+                return -1;
+            }
+            if (ParseRoi(argv[++i], &rois[roiCount++]) != 0) return -1;
+        }
+        else if (strcmp(argv[i], "--food") == 0 && i + 1 < argc)
+        {
+            if (ParseFood(argv[++i]) != 0) return -1;
+        }
+        else if (strcmp(argv[i], "--diffusion") == 0 && i + 1 < argc)
+        {
+            if (SetDiffusion(argv[++i]) != 0) return -1;
+        }
+        else if (strcmp(argv[i], "--deposit") == 0 && i + 1 < argc)
+        {
+            if (SetDeposit(argv[++i]) != 0) return -1;
+        }
+        else if (strcmp(argv[i], "--attract") == 0 && i + 1 < argc)
+        {
+            if (LoadMap(&attractMap, argv[++i]) != 0) return -1;
+        }
+        else if (strcmp(argv[i], "--obstacles") == 0 && i + 1 < argc)
+        {
+            if (LoadMap(&obstacleMap, argv[++i]) != 0) return -1;
+        }
+        else if (strcmp(argv[i], "--kernel") == 0 && i + 1 < argc)
+        {
+            if (UseAgentKernel(argv[++i]) != 0)
+            {
+                printf("Agent kernel %s is not available\n", argv[i]);
+                return -1;
+            }
+        }
+        else if (strcmp(argv[i], "--palette") == 0 && i + 1 < argc)
+        {
+            palette = FindPalette(argv[++i]);
+            if (palette < 0)
+            {
+                printf("Unknown palette %s\n", argv[i]);
+                return -1;
+            }
+        }
+        else
+        {
+            Usage(argv[0]);
+            return -1;
+        }
+    }
+
+    // Parameter file on top of the options, looked at again every few steps
+    ParamsWatch watch = {0};
+    if (paramsPath != NULL && WatchParams(&watch, paramsPath) != 0)
+    {
+        return -1;
+    }
+
+    // Single run with a fixed step, replays exactly for the same seed
+    if (tracePath != NULL && OpenTrace(tracePath, MAX(1, traceEvery)) != 0)
+    {
+        return -1;
+    }
+
+    SeedRandom(seed);
+    CreateGrid();
+    if (Spawn(spawn) != 0)
+    {
+        return -1;
+    }
+
+    // Region stats every few steps, the sums only redo rows below the first change
+    static RoiTable roiTable;
+    FILE *roiLog = NULL;
+    roiEvery = MAX(1, roiEvery);
+    if (roiCount > 0)
+    {
+        roiLog = fopen(roiPath, "w");
+        if (roiLog == NULL)
+        {
+            printf("Could not open %s\n", roiPath);
+            return -1;
+        }
+        fprintf(roiLog, "step,roi,x,y,width,height,mean_shade,covered,coverage,components,largest\n");
+    }
+
+    uint64_t start = Ticks();
+    for (int step = 0; step < steps; step++)
+    {
+        if (step % PARAMS_POLL_STEPS == 0)
+        {
+            PollParams(&watch);
+        }
+
+        Update(deltaTime);
+
+        if (roiLog != NULL && (step + 1) % roiEvery == 0)
+        {
+            UpdateRoiTable(&roiTable, grid, blockStep, simStep);
+            for (int r = 0; r < roiCount; r++)
+            {
+                Roi roi = ClipRoi(rois[r]);
+                RoiStats roiStats = QueryRoi(&roiTable, grid, roi);
+                fprintf(roiLog, "%d,%d,%d,%d,%d,%d,%.3f,%d,%.4f,%d,%d\n", step + 1, r, roi.x, roi.y, roi.width, roi.height,
+                        roiStats.meanShade, roiStats.covered, roiStats.coverage, roiStats.components, roiStats.largest);
+            }
+        }
+    }
+    double seconds = (double)(Ticks() - start)/TICKS_PER_SECOND;
+
+    printf("%d steps in %.3f s, %.0f agent steps/s, %d active tiles, mean shade %.3f\n",
+           steps, seconds, (double)N_AGENTS*steps/seconds, stats.activeTiles, stats.meanShade);
+
+    printf("State %.1f MB, %d of %zu huge pages\n", stateArena.size/1048576.0, CountHugePages(&stateArena),
+           stateArena.size/ARENA_HUGE_PAGE);
+    printf("State hash %016llx\n", (unsigned long long)HashState());
+    CloseTrace();
+    if (roiLog != NULL)
+    {
+        fclose(roiLog);
+    }
+
+    if (network != NULL && ExtractNetwork(grid, network) != 0)
+    {
+        return -1;
+    }
+
+    if (out != NULL)
+    {
+        SetPalette(palette);
+        WriteImage(out);
+    }
+
+    return 0;
+}
@@ -1,397 +1,362 @@
-
-#include<stdio.h>           // Standard input output library
-
 #include <stdlib.h>         // For random number generator
+#include <string.h>         // For memset
 #include <time.h>           // For initialization for randum number generator
-#include <math.h>           // For mathematical functions
 
 #include <SDL2/SDL.h>       // SDL2 for graphical window
+#include <SDL2/SDL_test_font.h> // Text for the stats overlay
 
+#include "sim.h"
 
-#define MAX(x, y) ((x > y) ? x : y)
-#define MIN(x, y) ((x < y) ? x : y)
-
-// Window Values
-#define CAM_WIDTH 1280      // Possible Values: 640, 1280
-#define CAM_HEIGHT 840      // Possible Values: 320, 840
-
-// Grid Values
-#define RECT_WIDTH 2
-#define RECT_HEIGHT 2
-
-#define ROWS CAM_HEIGHT/RECT_HEIGHT
-#define COLUMNS CAM_WIDTH/RECT_WIDTH
-
-#define GRID_SIZE  ROWS*COLUMNS
-
-#define BG_SHADE 0
 
-typedef struct Tile
-{
-    SDL_Rect rect;
-    Uint8 bw;
-    char changed;
-} Tile;
-
-// Agent Values
-#define N_AGENTS 10000
-#define SPEED 0.05f
-
-// Affects the tail
-#define TAIL_LENGTH 300
-#define DIFFUSE_SPEED 0.015
-#define EVAPORATE_SPEED 0.2f
-
-// Affects the following system
-#define SENSOR_SCOPE M_PI/6
-#define TURN_SPEED 0.3f
-#define SENSOR_OFFSET_DIST 3
-#define SENSOR_SIZE 3
-
-typedef struct Agent
+#define UPDATES_PER_FRAME 200
+#define FAST_FORWARD_SPEEDS 6
+#define FAST_FORWARD_STEPS {1, 2, 4, 8, 16, 64}   // Steps per published frame on keys 1 to 6
+#define DELTA_TIME_SCALE 100    // deltaTime units per second, as clock()/10000 gave
+#define MIN_DELTA_TIME 0.5      // Shortest step the window runs, long ones are sub-stepped
+
+// Camera Values
+#define MIN_ZOOM 0.125f
+#define MAX_ZOOM 32.0f
+#define ZOOM_STEP 1.25f       // Zoom factor per mouse wheel step
+#define PAN_STEP 40           // Window pixels moved per key press
+
+typedef struct Camera
 {
-    float xPos;
+    float xPos;             // Grid position of the top left corner of the window
     float yPos;
-    float angle;
-
-    float xPrev[TAIL_LENGTH];
-    float yPrev[TAIL_LENGTH];
-
-    float speed;
-} Agent;
-
-#define UPDATES_PER_FRAME 200
+    float zoom;             // 1 fits the grid to the window, 2 shows half of it, ...
+    char linear;            // Linear sampling instead of nearest
+} Camera;
 
 
-Agent agents[N_AGENTS];
-
-Tile grid[GRID_SIZE];
-Tile tempGrid[GRID_SIZE];
-
 SDL_Window *g_window;
 SDL_Renderer *g_renderer;
-
-float ColorMask[3] = {0.2, 0.6, 0.9};
-
-
-float Lerp(float a, float b, float f)
+SDL_Texture *g_texture;         // Whole grid, only changed blocks are uploaded
+SDL_Texture *g_coarseTexture;   // Pyramid levels when zoomed out
+
+Uint32 pixels[GRID_SIZE];
+uint64_t textureStep[DIRTY_BLOCKS]; // Step of the frame each block of g_texture came from
+
+Camera camera = {0, 0, 1, 0};
+
+char showStats = 0;
+char deterministic = 0;     // Fixed seed and step so runs can be replayed
+unsigned int seed = 0;
+const char *spawn = "circle";
+float renderMs = 0;
+const char *paramsPath = NULL;
+ParamsWatch paramsWatch;    // Polled by the window, published to the simulation
+
+// Shared with the simulation thread
+FrameBuffers frameBuffers;
+_Atomic int simQuit = 0;
+_Atomic int fastForward = 0;    // Extra updates requested by the window
+_Atomic int speed = 1;          // Steps per published frame, above 1 they are fixed size
+const int fastForwardSteps[FAST_FORWARD_SPEEDS] = FAST_FORWARD_STEPS;
+
+// Pyramid over the frame being drawn
+Mip viewMip;
+
+// Drag-selected region and its stats over the drawn frame
+Roi selection = {0, 0, 0, 0};
+char selecting = 0;
+float selectX, selectY;     // Grid position the drag started at
+RoiTable viewRoiTable;
+RoiStats selectionStats;
+uint64_t selectionStep = 0; // Frame step selectionStats are from, 0 when stale
+
+
+void DrawStats(const Frame *frame)
 {
-    return a + f * (b - a);
-}
+    SDL_Rect box = {0, 0, 24*FONT_CHARACTER_SIZE, (STATS_LINES + 2)*FONT_LINE_HEIGHT + 8};
 
-float Rand01()
-{
-    return (float)(rand()%1000)/1000;
-}
+    SDL_SetRenderDrawBlendMode(g_renderer, SDL_BLENDMODE_BLEND);
+    SDL_SetRenderDrawColor(g_renderer, 0, 0, 0, 160);
+    SDL_RenderFillRect(g_renderer, &box);
 
-void ChangeShade(int x, int y, Uint8 bw)
-{
-    // Finding apropriate rectangle
-    Tile *tile = &tempGrid[y*COLUMNS + x];
-    if (tile->changed == 0)
+    SDL_SetRenderDrawColor(g_renderer, 255, 255, 255, 255);
+    for (int i = 0; i < STATS_LINES; i++)
     {
-        //printf("hello\n");
-        tile->bw = bw;
+        SDLTest_DrawString(g_renderer, 4, 4 + i*FONT_LINE_HEIGHT, frame->statsLines[i]);
     }
-    tile->changed = 1;
+
+    // Window side, measured here
+    char line[64];
+    snprintf(line, sizeof(line), "render    %7.2f ms", renderMs);
+    SDLTest_DrawString(g_renderer, 4, 4 + STATS_LINES*FONT_LINE_HEIGHT, line);
+    snprintf(line, sizeof(line), "speed     x%d", atomic_load(&speed));
+    SDLTest_DrawString(g_renderer, 4, 4 + (STATS_LINES + 1)*FONT_LINE_HEIGHT, line);
 }
 
-void ChangeShadeBlur(int i, Uint8 bw)
+void DrawSelection(const Frame *frame)
 {
-    // Finding apropriate rectangle
-    Tile *tile = &tempGrid[i];
-    if (tile->changed == 0)
+    // Stats only change with the frame or the region
+    if (selectionStep != frame->step)
     {
-        tile->bw = bw;
+        UpdateRoiTable(&viewRoiTable, frame->tiles, frame->blockStep, frame->step);
+        selectionStats = QueryRoi(&viewRoiTable, frame->tiles, selection);
+        selectionStep = frame->step;
     }
-    else
+
+    // Grid cells to window pixels
+    SDL_FRect outline = {(selection.x - camera.xPos)*RECT_WIDTH*camera.zoom,
+                         (selection.y - camera.yPos)*RECT_HEIGHT*camera.zoom,
+                         selection.width*RECT_WIDTH*camera.zoom,
+                         selection.height*RECT_HEIGHT*camera.zoom};
+
+    SDL_SetRenderDrawColor(g_renderer, 255, 255, 0, 255);
+    SDL_RenderDrawRectF(g_renderer, &outline);
+
+    char lines[ROI_LINES][64];
+    snprintf(lines[0], 64, "region %d,%d %dx%d", selection.x, selection.y, selection.width, selection.height);
+    snprintf(lines[1], 64, "mean shade %.2f", selectionStats.meanShade);
+    snprintf(lines[2], 64, "coverage %.1f%% (%d)", 100*selectionStats.coverage, selectionStats.covered);
+    snprintf(lines[3], 64, "groups %d, largest %d", selectionStats.components, selectionStats.largest);
+
+    // Next to the region, kept inside the window
+    SDL_Rect box = {0, 0, 24*FONT_CHARACTER_SIZE, ROI_LINES*FONT_LINE_HEIGHT + 8};
+    box.x = MIN(CAM_WIDTH - box.w, MAX(0, (int)(outline.x + outline.w) + 4));
+    box.y = MIN(CAM_HEIGHT - box.h, MAX(0, (int)outline.y));
+
+    SDL_SetRenderDrawBlendMode(g_renderer, SDL_BLENDMODE_BLEND);
+    SDL_SetRenderDrawColor(g_renderer, 0, 0, 0, 160);
+    SDL_RenderFillRect(g_renderer, &box);
+
+    SDL_SetRenderDrawColor(g_renderer, 255, 255, 0, 255);
+    for (int i = 0; i < ROI_LINES; i++)
     {
-        tile->bw = MAX(tile->bw, bw);
+        SDLTest_DrawString(g_renderer, box.x + 4, box.y + 4 + i*FONT_LINE_HEIGHT, lines[i]);
     }
-    tile->changed = 1;
 }
 
-void ResetUpdate()
+void DragSelection(int mouseX, int mouseY)
 {
-    // Updates grid
-    memcpy(grid, tempGrid, sizeof(grid));
-
-    //Resets rectangles in grid
-    for (int i = 0; i < GRID_SIZE; i++)
-    {
-        Tile *tile = &tempGrid[i];
-        tile->changed = 0;
-    }
+    // Whole tiles between where the drag started and the mouse
+    float gridX = camera.xPos + mouseX/(RECT_WIDTH*camera.zoom);
+    float gridY = camera.yPos + mouseY/(RECT_HEIGHT*camera.zoom);
+
+    int x0 = floorf(MIN(selectX, gridX)), y0 = floorf(MIN(selectY, gridY));
+    int x1 = ceilf(MAX(selectX, gridX)), y1 = ceilf(MAX(selectY, gridY));
+    selection = ClipRoi((Roi){x0, y0, MAX(1, x1 - x0), MAX(1, y1 - y0)});
+    selectionStep = 0;
 }
 
-void UpdateTail(float *xPrev, float *yPrev, float xOld, float yOld)
+void ClampCamera()
 {
-    for (int i = TAIL_LENGTH-1; i > 0; i--)
+    camera.zoom = MIN(MAX_ZOOM, MAX(MIN_ZOOM, camera.zoom));
+
+    if (camera.zoom < 1)
     {
-        xPrev[i] = xPrev[i-1];
-        yPrev[i] = yPrev[i-1];
+        // Zoomed out, keeping the grid centred
+        camera.xPos = (COLUMNS - COLUMNS/camera.zoom)/2;
+        camera.yPos = (ROWS - ROWS/camera.zoom)/2;
+        return;
     }
 
-    xPrev[0] = xOld;
-    yPrev[0] = yOld;
+    // Keeping the view inside the grid
+    camera.xPos = MIN(COLUMNS - COLUMNS/camera.zoom, MAX(0, camera.xPos));
+    camera.yPos = MIN(ROWS - ROWS/camera.zoom, MAX(0, camera.yPos));
 }
 
-float Sense(Agent agent, float sensorAngleOffset)
+void PanCamera(int dx, int dy)
 {
-    float sensorAngle = agent.angle + sensorAngleOffset;
-
-    float sensorDirX = cos(sensorAngle);
-    float sensorDirY = sin(sensorAngle);
+    // Window pixels to grid cells
+    camera.xPos += dx/(RECT_WIDTH*camera.zoom);
+    camera.yPos += dy/(RECT_HEIGHT*camera.zoom);
+    ClampCamera();
+}
 
-    int sensorCentreX = agent.xPos + sensorDirX*SENSOR_OFFSET_DIST;
-    int sensorCentreY = agent.yPos + sensorDirY*SENSOR_OFFSET_DIST;
+void ZoomCamera(int mouseX, int mouseY, float factor)
+{
+    // Grid position under the mouse should stay under the mouse
+    float gridX = camera.xPos + mouseX/(RECT_WIDTH*camera.zoom);
+    float gridY = camera.yPos + mouseY/(RECT_HEIGHT*camera.zoom);
 
-    float sum = 0;
+    camera.zoom *= factor;
+    camera.zoom = MIN(MAX_ZOOM, MAX(MIN_ZOOM, camera.zoom));
 
-    for (int offsetX = -SENSOR_SIZE; offsetX <= SENSOR_SIZE; offsetX++)
-    {
-        for (int offsetY = -SENSOR_SIZE; offsetY <= SENSOR_SIZE; offsetY++)
-        {
-            int posX = sensorCentreX + offsetX;
-            int posY = sensorCentreY + offsetY;
+    camera.xPos = gridX - mouseX/(RECT_WIDTH*camera.zoom);
+    camera.yPos = gridY - mouseY/(RECT_HEIGHT*camera.zoom);
+    ClampCamera();
+}
 
-            if (posX >= 0 && posX < COLUMNS && posY >= 0 && posY < ROWS)
-            {
-                sum += grid[posY*COLUMNS + posX].bw;
-            }
-        }
-    }
+void NextPalette()
+{
+    SetPalette((paletteIndex + 1) % paletteCount);
 
-    return sum;
+    // Every block has to be color mapped again
+    memset(textureStep, 0, sizeof(textureStep));
 }
 
-void AgentUpdate(deltaTime)
+void UploadBlocks(const Frame *frame, int bx0, int by0, int bx1, int by1)
 {
-    // Updating every agent
-    for (int i = 0; i < N_AGENTS; i++)
+    for (int by = by0; by < by1; by++)
     {
-        // Draw curret position
+        int y0 = by*DIRTY_BLOCK;
+        int y1 = MIN(ROWS, y0 + DIRTY_BLOCK);
 
-        // Calculate directions
-        float Xdirection = cosf(agents[i].angle);
-        float Ydirection = sinf(agents[i].angle);
-
-        // Calculate new position
-        float newXPos = agents[i].xPos + Xdirection*agents[i].speed*deltaTime;
-        float newYPos = agents[i].yPos + Ydirection*agents[i].speed*deltaTime;
-
-        // Following system
-        float weightForward = Sense(agents[i], 0);
-        float weightLeft = Sense(agents[i], SENSOR_SCOPE);
-        float weightRight = Sense(agents[i], -SENSOR_SCOPE);
-
-        float steeringStrength = Rand01();
-
-        if (weightForward > weightLeft && weightForward > weightRight)
-        {
-            // No change in direction
-            agents[i].angle += 0;
-        }
-        else if (weightForward < weightLeft && weightForward < weightRight)
+        // Runs of changed blocks along the row go up in one rect
+        int bx = bx0;
+        while (bx < bx1)
         {
-            // Turn randomly
-            agents[i].angle += (steeringStrength - 0.5) * 2 * TURN_SPEED * deltaTime;
-        }
-        else if (weightRight > weightLeft)
-        {
-            //Turn left
-            agents[i].angle -= steeringStrength * TURN_SPEED * deltaTime;
-        }
-        else if (weightLeft > weightRight)
-        {
-            agents[i].angle += steeringStrength * TURN_SPEED * deltaTime;
-        }
-
-        // Check for collision with boundary
-        if (newXPos < 0 || newXPos > COLUMNS || newYPos < 0 || newYPos > ROWS)
-        {
-            newXPos = MIN(COLUMNS-0.01, MAX(0, newXPos));
-            newYPos = MIN(ROWS-0.01, MAX(0, newYPos));
+            if (frame->blockStep[by*DIRTY_COLUMNS + bx] <= textureStep[by*DIRTY_COLUMNS + bx])
+            {
+                bx++;
+                continue;
+            }
 
-            // Calculate new direction
-            agents[i].angle = 2 * M_PI * Rand01();
-        }
+            int runStart = bx;
+            while (bx < bx1 && frame->blockStep[by*DIRTY_COLUMNS + bx] > textureStep[by*DIRTY_COLUMNS + bx])
+            {
+                textureStep[by*DIRTY_COLUMNS + bx] = frame->step;
+                bx++;
+            }
 
-        // Update previous positions
-        UpdateTail(agents[i].xPrev, agents[i].yPrev, agents[i].xPos, agents[i].yPos);
+            int x0 = runStart*DIRTY_BLOCK;
+            int x1 = MIN(COLUMNS, bx*DIRTY_BLOCK);
+            for (int y = y0; y < y1; y++)
+            {
+                for (int x = x0; x < x1; x++)
+                {
+                    pixels[y*COLUMNS + x] = paletteLUT[frame->tiles[y*COLUMNS + x].bw];
+                }
+            }
 
-        agents[i].xPos = newXPos;           // Setting new x postion
-        agents[i].yPos = newYPos;           // Setting new y position
-        ChangeShade((int)newXPos, (int)newYPos, 255);
+            SDL_Rect run = {x0, y0, x1-x0, y1-y0};
+            SDL_UpdateTexture(g_texture, &run, &pixels[y0*COLUMNS + x0], COLUMNS*sizeof(Uint32));
+        }
     }
 }
 
-void Blur(double deltaTime)
+void Draw(const Frame *frame)
 {
-    // Looping over agents
-    for (int i = 0; i < N_AGENTS; i++)
+    // Kept across frames, a new one only redoes the blocks that changed since the pyramid was built
+    if (viewMip.tiles == NULL)
     {
-        // Looping over previous positions
-        for (int j = 0; j < TAIL_LENGTH; j++)
-        {
-            // Checking if previous position has been recorded
-            if(agents[i].xPrev[j] != -1 && agents[i].yPrev[j] != -1)
-            {
-                // Change shade for previous agent position
-                int grid_index = (int)agents[i].yPrev[j]*COLUMNS + (int)agents[i].xPrev[j];
-                float bw = grid[grid_index].bw-EVAPORATE_SPEED*deltaTime;
-                ChangeShadeBlur(grid_index, MAX(0, bw));
-            }
-        }
+        CreateMip(&viewMip, frame->tiles, NULL, frame->blockStep);
     }
+    viewMip.tiles = frame->tiles;
+    viewMip.blocks = frame->blockStep;
 
-
-    // Looping over grid
-    for (int i = 0; i < GRID_SIZE; i++)
+    // Zoomed out far enough for several tiles per pixel, reading a coarse level
+    int level = 0;
+    while (level + 1 < MIP_LEVELS && RECT_WIDTH*camera.zoom*(2 << level) <= 1)
     {
-        int sum = 0;
+        level++;
+    }
+
+    int scale = 1 << level;
+
+    // Finding visible part of the level
+    int x0 = MAX(0, (int)floorf(camera.xPos/scale));
+    int y0 = MAX(0, (int)floorf(camera.yPos/scale));
+    int x1 = MIN(viewMip.levels[level].width, (int)ceilf((camera.xPos + COLUMNS/camera.zoom)/scale) + 1);
+    int y1 = MIN(viewMip.levels[level].height, (int)ceilf((camera.yPos + ROWS/camera.zoom)/scale) + 1);
 
-        float origionalVal = (float)(grid[i].bw);
+    SDL_Rect visible = {x0, y0, x1-x0, y1-y0};
+    SDL_Texture *texture = g_texture;
 
-        // Finding neighbours
-        for (int x = -1; x <= 1; x++)
+    if (level == 0)
+    {
+        // Visible blocks that changed since they were last uploaded
+        UploadBlocks(frame, x0/DIRTY_BLOCK, y0/DIRTY_BLOCK,
+                     (x1 + DIRTY_BLOCK - 1)/DIRTY_BLOCK, (y1 + DIRTY_BLOCK - 1)/DIRTY_BLOCK);
+    }
+    else
+    {
+        // Coarse levels are small, color mapping all of the visible part
+        UpdateMip(&viewMip, level, frame->step);
+        for (int y = y0; y < y1; y++)
         {
-            for (int y = -1; y <= 1; y++)
+            for (int x = x0; x < x1; x++)
             {
-                int nx = i%(int)(COLUMNS) + x;
-                int ny = i/(int)(COLUMNS) + y;
-
-                if (x != 0 || y != 0)
-                {
-                    if (nx >= 0 && nx < COLUMNS && ny >= 0 && ny < ROWS)
-                    {
-                        sum += grid[i+COLUMNS*y+x].bw;
-                    }
-                }
+                pixels[y*COLUMNS + x] = paletteLUT[(Uint8)MipValue(&viewMip, level, x, y)];
             }
         }
 
-        float blurVal = ((float)(sum)/9);
-
-        float diffusedVal = Lerp(origionalVal, blurVal, DIFFUSE_SPEED*deltaTime);
-
-        float diffusedEvaporatedVal = MAX(0, diffusedVal - EVAPORATE_SPEED*deltaTime);
-
-        ChangeShadeBlur(i, diffusedEvaporatedVal);
+        SDL_UpdateTexture(g_coarseTexture, &visible, &pixels[y0*COLUMNS + x0], COLUMNS*sizeof(Uint32));
+        texture = g_coarseTexture;
     }
-}
 
-void Update(double deltaTime)
-{
-    AgentUpdate(deltaTime);
+    // Visible part scaled to the window, sampling is done by the renderer
+    SDL_FRect window = {(x0*scale - camera.xPos)*RECT_WIDTH*camera.zoom,
+                        (y0*scale - camera.yPos)*RECT_HEIGHT*camera.zoom,
+                        (MIN(COLUMNS, x1*scale) - x0*scale)*RECT_WIDTH*camera.zoom,
+                        (MIN(ROWS, y1*scale) - y0*scale)*RECT_HEIGHT*camera.zoom};
 
-    Blur(deltaTime);
+    SDL_SetTextureScaleMode(texture, camera.linear ? SDL_ScaleModeLinear : SDL_ScaleModeNearest);
 
-    ResetUpdate();
-}
+    // Background Color
+    SDL_SetRenderDrawColor(g_renderer, 255, 0, 0, 255);
 
-void Draw()
-{
     // Clear screen
     SDL_RenderClear(g_renderer);
 
-    // Drawing rectangles
-    for (int i = 0; i < GRID_SIZE; i++)
+    SDL_RenderCopyF(g_renderer, texture, &visible, &window);
+
+    if (selection.width > 0)
     {
-        SDL_SetRenderDrawColor(g_renderer,
-                               (Uint8)(grid[i].bw*ColorMask[0]),
-                               (Uint8)(grid[i].bw*ColorMask[1]),
-                               (Uint8)(grid[i].bw*ColorMask[2]),
-                               255);
-        SDL_RenderDrawRect(g_renderer, &grid[i].rect);
-        SDL_RenderFillRect(g_renderer, &grid[i].rect);
+        DrawSelection(frame);
     }
 
-    // Background Color
-    SDL_SetRenderDrawColor(g_renderer, 255, 0, 0, 255);
+    if (showStats)
+    {
+        DrawStats(frame);
+    }
 
     // Drawing to window
     SDL_RenderPresent(g_renderer);
 }
 
-void CircleSpawn()
+int Simulation(void *data)
 {
-    int radius = 100;
-    int i = 0;
-    for (float theta = 0; theta < 2*M_PI; theta += 2*M_PI/(N_AGENTS))
-    {
-        if (i < N_AGENTS)
-        {
-            float randomAngle = 2*M_PI*Rand01();
-            agents[i].xPos = COLUMNS/2 + (rand()%radius)*cos(randomAngle);
-            agents[i].yPos = ROWS/2 + (rand()%radius)*sin(randomAngle);
-
-            float vx = (COLUMNS/2 - agents[i].xPos) / sqrt(pow(COLUMNS/2, 2) + pow(agents[i].xPos, 2));
-            float vy = (ROWS/2 - agents[i].yPos) / sqrt(pow(ROWS/2, 2) + pow(agents[i].yPos, 2));
+    uint64_t time1 = Ticks();
 
-            agents[i].angle = atan2(vy, vx);
-            agents[i].speed = SPEED;
+    // Runs flat out, the window only ever sees published frames
+    while (atomic_load(&simQuit) == 0)
+    {
+        uint64_t time2 = Ticks();
+        double deltaTime = (double)(time2 - time1)/TICKS_PER_SECOND*DELTA_TIME_SCALE;
 
-            for (int j = 0; j < TAIL_LENGTH; j++)
-            {
-                agents[i].xPrev[j] = -1;
-                agents[i].yPrev[j] = -1;
-            }
+        // Read once each, the window changes them meanwhile
+        int steps = atomic_load(&speed);
+        int queued = atomic_load(&fastForward);
+        int extra = MIN(queued, fastForwardSteps[FAST_FORWARD_SPEEDS - 1]);   // Bursts over a few frames
 
-            i++;
+        // Steps shorter than this are mostly overhead, waiting for more time to pass
+        if (!deterministic && deltaTime < MIN_DELTA_TIME && steps == 1 && extra == 0)
+        {
+            SDL_Delay(1);
+            continue;
         }
-    }
-}
 
-void RandomSpawn()
-{
-    int i = 0;
-    for (float theta = 0; theta < 2*M_PI; theta += 2*M_PI/(N_AGENTS))
-    {
-        if (i < N_AGENTS)
+        if (steps > 1 || extra > 0)
         {
-            // agents[i].xPos = COLUMNS/2;
-            // agents[i].yPos = ROWS/2;
-
-            agents[i].xPos = rand()%COLUMNS;
-            agents[i].yPos = rand()%ROWS;
-
-            agents[i].angle = 2*M_PI*Rand01(); //atan2(vx, vy);
-            agents[i].speed = SPEED;
-
-            for (int j = 0; j < TAIL_LENGTH; j++)
-            {
-                agents[i].xPrev[j] = -1;
-                agents[i].yPrev[j] = -1;
-            }
-
-            i++;
+            // Fast forward, fixed steps batched into one frame. Only the last one
+            // updates changed blocks and stats, and the batch's own time is not stepped again
+            atomic_fetch_sub(&fastForward, extra);
+            UpdateSteps(DEFAULT_DELTA_TIME, steps + extra);
+            time1 = Ticks();
         }
-    }
-}
-
-void CreateGrid()
-{
-    int count = 0;
-    for (int y = 0; y < CAM_HEIGHT; y += RECT_HEIGHT)
-    {
-        for (int x = 0; x < CAM_WIDTH; x += RECT_WIDTH)
+        else
         {
-            SDL_Rect rect = {x, y, RECT_WIDTH, RECT_HEIGHT};
-            Tile tile = {rect, BG_SHADE, 0};
-
-            tempGrid[count] = tile;
-            grid[count] = tile;
-
-            count ++;
+            // A stalled frame is not made up in one step longer than a full blur
+            double maxDeltaTime = params.diffuseSpeed > 0 ? 1/params.diffuseSpeed : deltaTime;
+            time1 = time2;
+            Update(deterministic ? DEFAULT_DELTA_TIME : MIN(deltaTime, maxDeltaTime));
         }
+
+        SampleStats();
+        PublishFrame(&frameBuffers);
     }
+
+    return 0;
 }
 
 int GameWindow()
 {
     // Initialize random number generator
-    srand(time(NULL));
+    SeedRandom(deterministic ? seed : time(NULL));
 
     // Initialize window
     SDL_Init(SDL_INIT_VIDEO);
@@ -411,69 +376,138 @@ int GameWindow()
         return -1;
     }
 
-    // Creating renderer window
-    g_renderer = SDL_CreateRenderer(g_window, -1, SDL_RENDERER_ACCELERATED);
+    // Creating renderer window, vsync keeps the render thread from spinning
+    g_renderer = SDL_CreateRenderer(g_window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
+
+    // Grid sized texture, one texel per tile
+    g_texture = SDL_CreateTexture(g_renderer,
+                                  SDL_PIXELFORMAT_ARGB8888,
+                                  SDL_TEXTUREACCESS_STREAMING,
+                                  COLUMNS,
+                                  ROWS
+    );
+
+    // Level 1 is the largest coarse level drawn
+    g_coarseTexture = SDL_CreateTexture(g_renderer,
+                                        SDL_PIXELFORMAT_ARGB8888,
+                                        SDL_TEXTUREACCESS_STREAMING,
+                                        (COLUMNS + 1)/2,
+                                        (ROWS + 1)/2
+    );
 
     // Creating grid
     CreateGrid();
 
 
     // Initialize agents
-    CircleSpawn();
+    if (Spawn(spawn) != 0)
+    {
+        return -1;
+    }
+
+    OpenStats();
 
+    // First frame so there is something to draw before the simulation publishes
+    CreateFrameBuffers(&frameBuffers);
+    PublishFrame(&frameBuffers);
+
+    SDL_Thread *simulation = SDL_CreateThread(Simulation, "Simulation", NULL);
+    if (simulation == NULL) {
+        printf("Could not start simulation thread: %s\n", SDL_GetError());
+        return -1;
+    }
 
     SDL_Event e;            // General Event Structure
     char quit = 0;
 
     //SDL_EnableKeyRepeat(500, 30);
 
-    clock_t time1 = clock();
-    clock_t time2 = clock();
-    double deltaTime = 0;
-
-    char first = 0;
-
-    float time = 0;
+    uint64_t lastDraw = Ticks();
+    uint64_t lastParamsPoll = lastDraw;
 
     // Event loop
     while (quit == 0){
 
-        time2 = clock();
-        deltaTime = ((float)(time2-time1))/10000;
-
-        if (time > 50)
+        while (SDL_PollEvent(&e))
         {
-            while (SDL_PollEvent(&e))
-            {
-                if (e.type == SDL_QUIT){
-                    quit = 1;
-                }
+            if (e.type == SDL_QUIT){
+                quit = 1;
+            }
 
-                if (e.type == SDL_KEYDOWN){
-                    for (int i = 0; i < UPDATES_PER_FRAME; i++)
-                    {
-                        Update(deltaTime);
-                    }
-                }
+            if (e.type == SDL_MOUSEWHEEL){
+                int mouseX, mouseY;
+                SDL_GetMouseState(&mouseX, &mouseY);
+                ZoomCamera(mouseX, mouseY, e.wheel.y > 0 ? ZOOM_STEP : 1/ZOOM_STEP);
+            }
 
-                if (e.type == SDL_MOUSEBUTTONDOWN){
-                    quit = 1;
+            if (e.type == SDL_KEYDOWN){
+                switch (e.key.keysym.sym)
+                {
+                    // Camera controls
+                    case SDLK_LEFT:  PanCamera(-PAN_STEP, 0); break;
+                    case SDLK_RIGHT: PanCamera(PAN_STEP, 0);  break;
+                    case SDLK_UP:    PanCamera(0, -PAN_STEP); break;
+                    case SDLK_DOWN:  PanCamera(0, PAN_STEP);  break;
+                    case SDLK_l:     camera.linear = !camera.linear; break;
+                    case SDLK_HOME:  camera = (Camera){0, 0, 1, camera.linear}; break;
+
+                    case SDLK_TAB:   showStats = !showStats; break;
+                    case SDLK_p:     NextPalette(); break;
+                    case SDLK_n:     ExtractNetwork(AcquireFrame(&frameBuffers)->tiles, NETWORK_FILE); break;
+                    case SDLK_ESCAPE: quit = 1; break;
+
+                    // Speed, picked up by the simulation before its next frame
+                    case SDLK_1: case SDLK_2: case SDLK_3: case SDLK_4: case SDLK_5: case SDLK_6:
+                        atomic_store(&speed, fastForwardSteps[e.key.keysym.sym - SDLK_1]);
+                        break;
+
+                    default:
+                        atomic_fetch_add(&fastForward, UPDATES_PER_FRAME);
                 }
             }
 
-            Update(deltaTime);
-
-            Draw();
+            // Left drag selects a region to inspect, right click drops it
+            if (e.type == SDL_MOUSEBUTTONDOWN && e.button.button == SDL_BUTTON_LEFT){
+                selecting = 1;
+                selectX = camera.xPos + e.button.x/(RECT_WIDTH*camera.zoom);
+                selectY = camera.yPos + e.button.y/(RECT_HEIGHT*camera.zoom);
+                DragSelection(e.button.x, e.button.y);
+            }
+            if (e.type == SDL_MOUSEBUTTONDOWN && e.button.button == SDL_BUTTON_RIGHT){
+                selection = (Roi){0, 0, 0, 0};
+            }
+            if (e.type == SDL_MOUSEMOTION && selecting){
+                DragSelection(e.motion.x, e.motion.y);
+            }
+            if (e.type == SDL_MOUSEBUTTONUP && e.button.button == SDL_BUTTON_LEFT){
+                selecting = 0;
+            }
         }
-        else
+
+        Draw(AcquireFrame(&frameBuffers));
+
+        uint64_t now = Ticks();
+        renderMs = Lerp(renderMs, 1000.0f*(now - lastDraw)/TICKS_PER_SECOND, 0.1f);
+        lastDraw = now;
+
+        // The simulation picks a new block up before its next step, it never waits for this
+        if (now - lastParamsPoll >= PARAMS_POLL_MS*TICKS_PER_SECOND/1000)
         {
-            time += deltaTime;
+            PollParams(&paramsWatch);
+            lastParamsPoll = now;
         }
-
-        time1 = time2;
     }
 
+    atomic_store(&simQuit, 1);
+    SDL_WaitThread(simulation, NULL);
+
+    CloseStats();
+    CloseTrace();
+
     // Destroying window
+    SDL_DestroyTexture(g_coarseTexture);
+    SDL_DestroyTexture(g_texture);
+    SDL_DestroyRenderer(g_renderer);
     SDL_DestroyWindow(g_window);
 
     // Quitting SDL ...
@@ -482,8 +516,90 @@ int GameWindow()
     return 0;
 }
 
-int main(void)
+int main(int argc, char *argv[])
 {
+    printf("Agent kernel: %s\n", SelectAgentKernel());
+
+    // Everything a run needs, allocated once
+    if (CreateState() != 0)
+    {
+        return -1;
+    }
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+        {
+            deterministic = 1;
+            seed = strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--spawn") == 0 && i + 1 < argc)
+        {
+            spawn = argv[++i];
+        }
+        else if (strcmp(argv[i], "--food") == 0 && i + 1 < argc)
+        {
+            if (ParseFood(argv[++i]) != 0)
+            {
+                return -1;
+            }
+        }
+        else if (strcmp(argv[i], "--diffusion") == 0 && i + 1 < argc)
+        {
+            if (SetDiffusion(argv[++i]) != 0)
+            {
+                return -1;
+            }
+        }
+        else if (strcmp(argv[i], "--deposit") == 0 && i + 1 < argc)
+        {
+            if (SetDeposit(argv[++i]) != 0)
+            {
+                return -1;
+            }
+        }
+        else if (strcmp(argv[i], "--attract") == 0 && i + 1 < argc)
+        {
+            if (LoadMap(&attractMap, argv[++i]) != 0)
+            {
+                return -1;
+            }
+        }
+        else if (strcmp(argv[i], "--obstacles") == 0 && i + 1 < argc)
+        {
+            if (LoadMap(&obstacleMap, argv[++i]) != 0)
+            {
+                return -1;
+            }
+        }
+        else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+        {
+            if (OpenTrace(argv[++i], TRACE_INTERVAL) != 0)
+            {
+                return -1;
+            }
+        }
+        else if (strcmp(argv[i], "--params") == 0 && i + 1 < argc)
+        {
+            paramsPath = argv[++i];
+        }
+        else
+        {
+            printf("Usage: %s [--seed N] [--trace trace.csv] [--spawn PATTERN]\n", argv[0]);
+            printf("       %*s [--attract map.pgm] [--obstacles map.pgm] [--food X,Y]...\n", (int)strlen(argv[0]), "");
+            printf("       %*s [--diffusion KERNEL] [--deposit tile|add|splat[:AMOUNT]] [--params params.txt]\n", (int)strlen(argv[0]), "");
+            printf("Spawn patterns:");
+            ListSpawnPatterns();
+            return -1;
+        }
+    }
+
+    // Read once now, then again whenever it changes
+    if (paramsPath != NULL && WatchParams(&paramsWatch, paramsPath) != 0)
+    {
+        return -1;
+    }
+
     int ExitCode = GameWindow();
     return ExitCode;
 }
@@ -0,0 +1,135 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <fcntl.h>          // For opening maps
+#include <unistd.h>
+#include <sys/mman.h>       // For mapping maps instead of reading them
+#include <sys/stat.h>
+
+#include "sim.h"
+
+
+MapLayer attractMap;
+MapLayer obstacleMap;
+
+
+int ParseMapToken(const uint8_t *bytes, size_t size, size_t *at)
+{
+    // PGM header numbers, skipping whitespace and comments
+    while (*at < size && (bytes[*at] == '#' || bytes[*at] == ' ' || bytes[*at] == '\t' || bytes[*at] == '\n' || bytes[*at] == '\r'))
+    {
+        if (bytes[*at] == '#')
+        {
+            while (*at < size && bytes[*at] != '\n') (*at)++;
+        }
+        (*at)++;
+    }
+
+    int value = -1;
+    for (; *at < size && bytes[*at] >= '0' && bytes[*at] <= '9'; (*at)++)
+    {
+        value = MAX(0, value)*10 + bytes[*at] - '0';
+    }
+    return value;
+}
+
+void UnloadMap(MapLayer *layer)
+{
+    if (layer->mapping != NULL)
+    {
+        munmap(layer->mapping, layer->mappingSize);
+    }
+    else
+    {
+        free((void *)layer->data);
+    }
+    *layer = (MapLayer){NULL, NULL, 0};
+}
+
+int LoadMap(MapLayer *layer, const char *path)
+{
+    UnloadMap(layer);
+
+    int fd = open(path, O_RDONLY);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0 || info.st_size == 0)
+    {
+        printf("Could not open %s\n", path);
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+
+    // A spare page after the file so 4 byte gathers of the last tile stay mapped
+    size_t size = info.st_size;
+    size_t mappingSize = size + sysconf(_SC_PAGESIZE);
+    uint8_t *mapping = mmap(NULL, mappingSize, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED || mmap(mapping, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED)
+    {
+        printf("Could not map %s\n", path);
+        if (mapping != MAP_FAILED) munmap(mapping, mappingSize);
+        close(fd);
+        return -1;
+    }
+    close(fd);
+
+    // Raw maps are one byte per tile, row by row
+    if (size == (size_t)(GRID_SIZE))
+    {
+        *layer = (MapLayer){mapping, mapping, mappingSize};
+        return 0;
+    }
+
+    // Otherwise an 8 bit binary PGM
+    size_t at = 2;
+    int width = -1, height = -1, maxValue = -1;
+    if (size > 2 && mapping[0] == 'P' && mapping[1] == '5')
+    {
+        width = ParseMapToken(mapping, size, &at);
+        height = ParseMapToken(mapping, size, &at);
+        maxValue = ParseMapToken(mapping, size, &at);
+        at++;               // Single whitespace before the pixels
+    }
+
+    if (width <= 0 || height <= 0 || maxValue != 255 || at + (size_t)width*height > size)
+    {
+        printf("%s is neither a %dx%d raw map nor an 8 bit binary PGM\n", path, COLUMNS, ROWS);
+        munmap(mapping, mappingSize);
+        return -1;
+    }
+
+    // Pixels are used in place when the image is grid sized
+    if (width == COLUMNS && height == ROWS)
+    {
+        *layer = (MapLayer){mapping + at, mapping, mappingSize};
+        return 0;
+    }
+
+    // Any other size is stretched over the grid, which needs a copy
+    uint8_t *data = malloc(GRID_SIZE + 4);
+    for (int y = 0; y < ROWS; y++)
+    {
+        for (int x = 0; x < COLUMNS; x++)
+        {
+            data[y*COLUMNS + x] = mapping[at + (size_t)(y*height/(ROWS))*width + x*width/(COLUMNS)];
+        }
+    }
+    memset(data + GRID_SIZE, 0, 4);
+    munmap(mapping, mappingSize);
+
+    *layer = (MapLayer){data, NULL, 0};
+    return 0;
+}
+
+int SenseMap(const uint8_t *map, int centreX, int centreY)
+{
+    // Sensor area of a static map, same clipping as the grid
+    int sum = 0;
+    for (int posY = MAX(0, centreY - SENSOR_SIZE); posY <= MIN(ROWS - 1, centreY + SENSOR_SIZE); posY++)
+    {
+        for (int posX = MAX(0, centreX - SENSOR_SIZE); posX <= MIN(COLUMNS - 1, centreX + SENSOR_SIZE); posX++)
+        {
+            sum += map[posY*COLUMNS + posX];
+        }
+    }
+    return sum;
+}
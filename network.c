@@ -0,0 +1,424 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <unistd.h>         // For the core count
+#include <pthread.h>        // For thinning bands in parallel
+
+#include "sim.h"
+
+
+// Network Values
+#define NETWORK_THREAD_ROWS 64  // Rows per thread before thinning goes parallel
+#define NETWORK_MIN_LOOP 4      // Shortest edge that may start and end at the same node
+#define NETWORK_FOOD_SNAP 8     // How far a food source looks for the skeleton
+
+// Neighbour bits, clockwise from north
+#define N_N  1
+#define N_NE 2
+#define N_E  4
+#define N_SE 8
+#define N_S  16
+#define N_SW 32
+#define N_W  64
+#define N_NW 128
+
+typedef struct ThinBand
+{
+    const uint8_t *image;
+    uint8_t *next;
+    int pass;
+    int rowStart;
+    int rowEnd;
+    int removed;
+} ThinBand;
+
+typedef struct NetworkNode
+{
+    double xSum;
+    double ySum;
+    int pixels;
+    int food;
+    int id;
+} NetworkNode;
+
+
+Food foods[MAX_FOOD];
+int foodCount = 0;
+
+// Zhang-Suen deletions per neighbourhood, one table per sub-iteration
+uint8_t thinRemove[2][256];
+uint8_t crossings[256];         // 0 to 1 transitions around the neighbourhood
+int thinTablesBuilt = 0;
+
+uint8_t skeleton[GRID_SIZE];
+uint8_t thinBuffer[GRID_SIZE];
+uint8_t visited[GRID_SIZE];
+int parent[GRID_SIZE];          // Union-find over node pixels
+
+
+int ParseFood(const char *text)
+{
+    int x, y;
+    if (sscanf(text, "%d,%d", &x, &y) != 2 || x < 0 || x >= COLUMNS || y < 0 || y >= ROWS)
+    {
+        printf("Food has to be X,Y inside %dx%d, got %s\n", COLUMNS, ROWS, text);
+        return -1;
+    }
+    if (foodCount == MAX_FOOD)
+    {
+        printf("At most %d food sources\n", MAX_FOOD);
+        return -1;
+    }
+
+    foods[foodCount++] = (Food){x, y};
+    return 0;
+}
+
+void DepositFood()
+{
+    // Food keeps its disc at full shade every step
+    for (int f = 0; f < foodCount; f++)
+    {
+        for (int y = MAX(0, foods[f].y - FOOD_RADIUS); y <= MIN(ROWS - 1, foods[f].y + FOOD_RADIUS); y++)
+        {
+            for (int x = MAX(0, foods[f].x - FOOD_RADIUS); x <= MIN(COLUMNS - 1, foods[f].x + FOOD_RADIUS); x++)
+            {
+                int dx = x - foods[f].x;
+                int dy = y - foods[f].y;
+                if (dx*dx + dy*dy <= FOOD_RADIUS*FOOD_RADIUS)
+                {
+                    ChangeShadeBlur(y*COLUMNS + x, 255);
+                }
+            }
+        }
+    }
+}
+
+void BuildThinTables()
+{
+    for (int n = 0; n < 256; n++)
+    {
+        int count = __builtin_popcount(n);
+        int transitions = 0;
+        for (int b = 0; b < 8; b++)
+        {
+            transitions += !(n & (1 << b)) && (n & (1 << ((b + 1) % 8)));
+        }
+        crossings[n] = transitions;
+
+        int north = (n & N_N) != 0, east = (n & N_E) != 0, south = (n & N_S) != 0, west = (n & N_W) != 0;
+        int candidate = count >= 2 && count <= 6 && transitions == 1;
+        thinRemove[0][n] = candidate && !(north && east && south) && !(east && south && west);
+        thinRemove[1][n] = candidate && !(north && east && west) && !(north && south && west);
+    }
+}
+
+int Neighbourhood(const uint8_t *image, int x, int y)
+{
+    // Outside the grid counts as background
+    int up = y > 0, down = y < ROWS - 1, left = x > 0, right = x < COLUMNS - 1;
+    const uint8_t *at = &image[y*COLUMNS + x];
+
+    return (up && at[-COLUMNS])                        * N_N  |
+           (up && right && at[-COLUMNS + 1])           * N_NE |
+           (right && at[1])                            * N_E  |
+           (down && right && at[COLUMNS + 1])          * N_SE |
+           (down && at[COLUMNS])                       * N_S  |
+           (down && left && at[COLUMNS - 1])           * N_SW |
+           (left && at[-1])                            * N_W  |
+           (up && left && at[-COLUMNS - 1])            * N_NW;
+}
+
+void *ThinThread(void *data)
+{
+    // Reads only the previous image, so bands are independent
+    ThinBand *band = data;
+    band->removed = 0;
+    for (int y = band->rowStart; y < band->rowEnd; y++)
+    {
+        for (int x = 0; x < COLUMNS; x++)
+        {
+            int i = y*COLUMNS + x;
+            int remove = band->image[i] && thinRemove[band->pass][Neighbourhood(band->image, x, y)];
+            band->next[i] = band->image[i] && !remove;
+            band->removed += remove;
+        }
+    }
+    return NULL;
+}
+
+void Thin(uint8_t *image)
+{
+    int threads = MAX(1, MIN(sysconf(_SC_NPROCESSORS_ONLN), ROWS/NETWORK_THREAD_ROWS));
+    ThinBand bands[threads];
+    pthread_t workers[threads];
+    int started[threads];
+
+    uint8_t *current = image;
+    uint8_t *next = thinBuffer;
+    int removed = 0;
+    int pass = 0;
+
+    do
+    {
+        if (pass == 0)
+        {
+            removed = 0;
+        }
+
+        for (int t = 0; t < threads; t++)
+        {
+            bands[t] = (ThinBand){current, next, pass, (ROWS)*t/threads, (ROWS)*(t + 1)/threads, 0};
+            started[t] = t > 0 && pthread_create(&workers[t], NULL, ThinThread, &bands[t]) == 0;
+            if (t > 0 && !started[t])
+            {
+                ThinThread(&bands[t]);
+            }
+        }
+        ThinThread(&bands[0]);
+
+        for (int t = 0; t < threads; t++)
+        {
+            if (started[t])
+            {
+                pthread_join(workers[t], NULL);
+            }
+            removed += bands[t].removed;
+        }
+
+        uint8_t *swap = current;
+        current = next;
+        next = swap;
+        pass = !pass;
+    }
+    // Done once both sub-iterations come up empty
+    while (removed > 0 || pass == 1);
+
+    if (current != image)
+    {
+        memcpy(image, current, GRID_SIZE);
+    }
+}
+
+int Find(int i)
+{
+    while (parent[i] != i)
+    {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+    return i;
+}
+
+void Union(int a, int b)
+{
+    a = Find(a);
+    b = Find(b);
+    parent[MAX(a, b)] = MIN(a, b);
+}
+
+int IsNode(int i)
+{
+    return parent[i] >= 0;
+}
+
+int ExtractNetwork(const Tile *tiles, const char *path)
+{
+    uint64_t start = Ticks();
+
+    FILE *file = fopen(path, "w");
+    if (file == NULL)
+    {
+        printf("Could not write %s\n", path);
+        return -1;
+    }
+
+    if (!thinTablesBuilt)
+    {
+        BuildThinTables();
+        thinTablesBuilt = 1;
+    }
+
+    // Bright trails, thinned to one pixel wide lines
+    for (int i = 0; i < GRID_SIZE; i++)
+    {
+        skeleton[i] = tiles[i].bw >= NETWORK_THRESHOLD;
+    }
+    Thin(skeleton);
+
+    // Line ends and junctions become node pixels, -1 marks line pixels and background
+    for (int y = 0; y < ROWS; y++)
+    {
+        for (int x = 0; x < COLUMNS; x++)
+        {
+            int i = y*COLUMNS + x;
+            int n = Neighbourhood(skeleton, x, y);
+            parent[i] = skeleton[i] && n != 0 && crossings[n] != 2 ? i : -1;
+            visited[i] = 0;
+        }
+    }
+
+    // Food snaps to the closest skeleton pixel and always is a node
+    int foodPixel[MAX_FOOD];
+    for (int f = 0; f < foodCount; f++)
+    {
+        foodPixel[f] = -1;
+        int best = NETWORK_FOOD_SNAP*NETWORK_FOOD_SNAP + 1;
+        for (int y = MAX(0, foods[f].y - NETWORK_FOOD_SNAP); y <= MIN(ROWS - 1, foods[f].y + NETWORK_FOOD_SNAP); y++)
+        {
+            for (int x = MAX(0, foods[f].x - NETWORK_FOOD_SNAP); x <= MIN(COLUMNS - 1, foods[f].x + NETWORK_FOOD_SNAP); x++)
+            {
+                int distance = (x - foods[f].x)*(x - foods[f].x) + (y - foods[f].y)*(y - foods[f].y);
+                if (skeleton[y*COLUMNS + x] && distance < best)
+                {
+                    best = distance;
+                    foodPixel[f] = y*COLUMNS + x;
+                }
+            }
+        }
+        if (foodPixel[f] >= 0 && parent[foodPixel[f]] < 0)
+        {
+            parent[foodPixel[f]] = foodPixel[f];
+        }
+    }
+
+    // Touching node pixels are one node, only earlier neighbours need a look
+    for (int y = 0; y < ROWS; y++)
+    {
+        for (int x = 0; x < COLUMNS; x++)
+        {
+            int i = y*COLUMNS + x;
+            if (!IsNode(i))
+            {
+                continue;
+            }
+            if (x > 0 && IsNode(i - 1))                                  Union(i, i - 1);
+            if (y > 0 && IsNode(i - COLUMNS))                            Union(i, i - COLUMNS);
+            if (y > 0 && x > 0 && IsNode(i - COLUMNS - 1))               Union(i, i - COLUMNS - 1);
+            if (y > 0 && x < COLUMNS - 1 && IsNode(i - COLUMNS + 1))     Union(i, i - COLUMNS + 1);
+        }
+    }
+
+    // Node ids and centres from the component roots
+    int nodeCount = 0;
+    NetworkNode *nodes = calloc(GRID_SIZE, sizeof(NetworkNode));
+    for (int i = 0; i < GRID_SIZE; i++)
+    {
+        if (IsNode(i))
+        {
+            NetworkNode *node = &nodes[Find(i)];
+            node->xSum += i % (COLUMNS) + 0.5;
+            node->ySum += i / (COLUMNS) + 0.5;
+            node->pixels++;
+        }
+    }
+    for (int f = 0; f < foodCount; f++)
+    {
+        if (foodPixel[f] >= 0)
+        {
+            nodes[Find(foodPixel[f])].food = 1;
+        }
+    }
+
+    fprintf(file, "# node id x y food\n");
+    for (int i = 0; i < GRID_SIZE; i++)
+    {
+        if (nodes[i].pixels > 0)
+        {
+            nodes[i].id = nodeCount++;
+            fprintf(file, "node %d %.1f %.1f %d\n", nodes[i].id, nodes[i].xSum/nodes[i].pixels, nodes[i].ySum/nodes[i].pixels, nodes[i].food);
+        }
+    }
+
+    // Walking every line from the node pixels it leaves, 4 neighbours before diagonals
+    const int dx[8] = {0, 1, 0, -1, 1, 1, -1, -1};
+    const int dy[8] = {-1, 0, 1, 0, -1, 1, 1, -1};
+    int edgeCount = 0;
+
+    fprintf(file, "# edge from to length mean_shade\n");
+    for (int i = 0; i < GRID_SIZE; i++)
+    {
+        if (!IsNode(i))
+        {
+            continue;
+        }
+        int from = Find(i);
+
+        for (int d = 0; d < 8; d++)
+        {
+            int x = i % (COLUMNS) + dx[d];
+            int y = i / (COLUMNS) + dy[d];
+            if (x < 0 || x >= COLUMNS || y < 0 || y >= ROWS)
+            {
+                continue;
+            }
+
+            int current = y*COLUMNS + x;
+            if (!skeleton[current] || IsNode(current) || visited[current])
+            {
+                continue;
+            }
+
+            visited[current] = 1;
+            double length = d < 4 ? 1 : M_SQRT2;
+            double shade = tiles[current].bw;
+            int steps = 1;
+            int to = -1;
+
+            while (to < 0)
+            {
+                int cx = current % (COLUMNS);
+                int cy = current / (COLUMNS);
+                int next = -1;
+                int nextDirection = 0;
+
+                for (int e = 0; e < 8 && to < 0; e++)
+                {
+                    int nx = cx + dx[e];
+                    int ny = cy + dy[e];
+                    if (nx < 0 || nx >= COLUMNS || ny < 0 || ny >= ROWS)
+                    {
+                        continue;
+                    }
+
+                    int n = ny*COLUMNS + nx;
+                    if (IsNode(n) && (Find(n) != from || steps >= NETWORK_MIN_LOOP))
+                    {
+                        to = Find(n);
+                        length += e < 4 ? 1 : M_SQRT2;
+                    }
+                    else if (next < 0 && skeleton[n] && !IsNode(n) && !visited[n])
+                    {
+                        next = n;
+                        nextDirection = e;
+                    }
+                }
+
+                // Dead ends only happen on lines the thinning left broken
+                if (to >= 0 || next < 0)
+                {
+                    break;
+                }
+
+                visited[next] = 1;
+                length += nextDirection < 4 ? 1 : M_SQRT2;
+                shade += tiles[next].bw;
+                current = next;
+                steps++;
+            }
+
+            if (to >= 0)
+            {
+                fprintf(file, "edge %d %d %.2f %.1f\n", nodes[from].id, nodes[to].id, length, shade/steps);
+                edgeCount++;
+            }
+        }
+    }
+
+    fclose(file);
+    free(nodes);
+
+    printf("Network with %d nodes and %d edges written to %s in %.1f ms\n",
+           nodeCount, edgeCount, path, 1000.0*(Ticks() - start)/TICKS_PER_SECOND);
+    return 0;
+}
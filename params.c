@@ -0,0 +1,179 @@
+#include <stdlib.h>
+#include <string.h>         // For parsing parameter files
+
+#include <sys/stat.h>       // For noticing changed files
+
+#include "sim.h"
+
+
+// Field names of Params, in order
+const char *const paramNames[PARAM_COUNT] = {"turn_speed", "sensor_scope", "evaporate_speed", "diffuse_speed", "deposit_amount"};
+
+// Lowest and highest value of each field, the deposit limit is the one SetDeposit has
+const float paramLimits[PARAM_COUNT][2] = {{0, INFINITY}, {-INFINITY, INFINITY}, {0, INFINITY}, {0, INFINITY}, {0, 255}};
+
+// Newest block waiting for the simulation, owned by whoever takes it out
+_Atomic(Params *) pendingParams = NULL;
+
+
+int FindParam(const char *name)
+{
+    for (int p = 0; p < PARAM_COUNT; p++)
+    {
+        if (strcmp(name, paramNames[p]) == 0)
+        {
+            return p;
+        }
+    }
+    return -1;
+}
+
+int CheckParam(int p, float value)
+{
+    // NaN fails both comparisons
+    if (value >= paramLimits[p][0] && value <= paramLimits[p][1])
+    {
+        return 0;
+    }
+
+    if (isinf(paramLimits[p][1]))
+    {
+        printf("%s has to be at least %g, got %g\n", paramNames[p], paramLimits[p][0], value);
+    }
+    else
+    {
+        printf("%s has to be from %g to %g, got %g\n", paramNames[p], paramLimits[p][0], paramLimits[p][1], value);
+    }
+    return -1;
+}
+
+int ReadParams(const char *path, Params *out)
+{
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+    {
+        printf("Could not open %s\n", path);
+        return -1;
+    }
+
+    // One "name value" per line, # starts a comment, missing names keep their value
+    Params read = *out;
+    float *values = (float *)&read;
+    char line[256];
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        char name[64];
+        float value;
+        int fields = sscanf(line, "%63s %f", name, &value);
+        if (fields < 1 || name[0] == '#')
+        {
+            continue;
+        }
+
+        int p = FindParam(name);
+        if (p < 0 || fields < 2)
+        {
+            printf("%s: %s\n", path, p < 0 ? "unknown parameter" : "missing value");
+            printf("%s", line);
+            fclose(file);
+            return -1;
+        }
+        if (CheckParam(p, value) != 0)
+        {
+            printf("%s: %s", path, line);
+            fclose(file);
+            return -1;
+        }
+        values[p] = value;
+    }
+    fclose(file);
+
+    *out = read;
+    return 0;
+}
+
+void PublishParams(const Params *next)
+{
+    // Whole block swapped in at once, an older one nobody took is dropped
+    Params *block = malloc(sizeof(Params));
+    *block = *next;
+    free(atomic_exchange(&pendingParams, block));
+}
+
+int ApplyParams()
+{
+    // Called between steps, so a step never sees half of a change
+    if (atomic_load_explicit(&pendingParams, memory_order_relaxed) == NULL)
+    {
+        return 0;
+    }
+
+    Params *next = atomic_exchange(&pendingParams, NULL);
+    if (next == NULL)
+    {
+        return 0;
+    }
+    params = *next;
+    free(next);
+    return 1;
+}
+
+long long ModifiedTime(const struct stat *info)
+{
+    // Nanoseconds, the field is named differently on macOS
+#ifdef __APPLE__
+    return info->st_mtimespec.tv_sec*1000000000ll + info->st_mtimespec.tv_nsec;
+#else
+    return info->st_mtim.tv_sec*1000000000ll + info->st_mtim.tv_nsec;
+#endif
+}
+
+int WatchParams(ParamsWatch *watch, const char *path)
+{
+    // Starts from the current parameters, the file only has to name what it changes
+    *watch = (ParamsWatch){path, params, 0, 0};
+    if (ReadParams(path, &watch->params) != 0)
+    {
+        return -1;
+    }
+
+    struct stat info;
+    if (stat(path, &info) == 0)
+    {
+        watch->modified = ModifiedTime(&info);
+        watch->size = info.st_size;
+    }
+
+    params = watch->params;
+    return 0;
+}
+
+int PollParams(ParamsWatch *watch)
+{
+    // Only a stat per call unless the file changed
+    struct stat info;
+    if (watch->path == NULL || stat(watch->path, &info) != 0)
+    {
+        return 0;
+    }
+
+    long long modified = ModifiedTime(&info);
+    if (modified == watch->modified && info.st_size == watch->size)
+    {
+        return 0;
+    }
+    watch->modified = modified;
+    watch->size = info.st_size;
+
+    // A half written file fails here and is read again on its next change
+    Params next = watch->params;
+    if (ReadParams(watch->path, &next) != 0)
+    {
+        return -1;
+    }
+
+    watch->params = next;
+    PublishParams(&next);
+    printf("Parameters reloaded from %s\n", watch->path);
+    return 1;
+}
@@ -0,0 +1,149 @@
+#include <stdlib.h>
+
+#include "sim.h"
+
+
+int ParseRoi(const char *text, Roi *roi)
+{
+    // "x,y,width,height" in tiles
+    if (sscanf(text, "%d,%d,%d,%d", &roi->x, &roi->y, &roi->width, &roi->height) != 4 ||
+        roi->width <= 0 || roi->height <= 0 || ClipRoi(*roi).width == 0)
+    {
+        printf("Region has to be X,Y,WIDTH,HEIGHT overlapping the %dx%d grid, got %s\n", COLUMNS, ROWS, text);
+        return -1;
+    }
+    return 0;
+}
+
+Roi ClipRoi(Roi roi)
+{
+    // Part inside the grid, empty when there is none
+    int x0 = MAX(0, roi.x), y0 = MAX(0, roi.y);
+    int x1 = MIN(COLUMNS, roi.x + roi.width), y1 = MIN(ROWS, roi.y + roi.height);
+
+    if (x1 <= x0 || y1 <= y0)
+    {
+        return (Roi){0, 0, 0, 0};
+    }
+    return (Roi){x0, y0, x1 - x0, y1 - y0};
+}
+
+void UpdateRoiTable(RoiTable *table, const Tile *tiles, const uint64_t *blocks, uint64_t step)
+{
+    // Sums above the first changed block row are still right, only the rest is redone
+    int firstRow = table->step == 0 ? 0 : ROWS;
+    for (int b = 0; b < DIRTY_BLOCKS && firstRow > 0; b++)
+    {
+        if (blocks[b] > table->step)
+        {
+            firstRow = MIN(firstRow, (b/DIRTY_COLUMNS)*DIRTY_BLOCK);
+        }
+    }
+
+    int stride = COLUMNS + 1;
+    for (int y = firstRow; y < ROWS; y++)
+    {
+        const Tile *row = &tiles[y*COLUMNS];
+        uint32_t *shade = &table->shade[(y + 1)*stride];
+        uint32_t *covered = &table->covered[(y + 1)*stride];
+
+        uint32_t shadeRun = 0, coveredRun = 0;
+        for (int x = 0; x < COLUMNS; x++)
+        {
+            shadeRun += row[x].bw;
+            coveredRun += row[x].bw >= ROI_THRESHOLD;
+            shade[x + 1] = shade[x + 1 - stride] + shadeRun;
+            covered[x + 1] = covered[x + 1 - stride] + coveredRun;
+        }
+    }
+
+    table->step = step;
+}
+
+uint32_t RectangleSum(const uint32_t *sums, Roi roi)
+{
+    int stride = COLUMNS + 1;
+    int top = roi.y*stride, bottom = (roi.y + roi.height)*stride;
+    return sums[bottom + roi.x + roi.width] - sums[bottom + roi.x] - sums[top + roi.x + roi.width] + sums[top + roi.x];
+}
+
+uint32_t RoiShadeSum(const RoiTable *table, Roi roi)
+{
+    return RectangleSum(table->shade, ClipRoi(roi));
+}
+
+uint32_t RoiCoveredCount(const RoiTable *table, Roi roi)
+{
+    return RectangleSum(table->covered, ClipRoi(roi));
+}
+
+int RoiComponents(const Tile *tiles, Roi roi, int *largest)
+{
+    // Connectivity is not a sum, so this one is a flood fill over the region
+    roi = ClipRoi(roi);
+    int size = roi.width*roi.height;
+    uint8_t *seen = calloc(size, 1);
+    int *stack = malloc(sizeof(int)*MAX(1, size));
+
+    int components = 0;
+    *largest = 0;
+    for (int start = 0; start < size; start++)
+    {
+        if (seen[start] || tiles[(roi.y + start/roi.width)*COLUMNS + roi.x + start%roi.width].bw < ROI_THRESHOLD)
+        {
+            continue;
+        }
+
+        int top = 0, tileCount = 0;
+        stack[top++] = start;
+        seen[start] = 1;
+        while (top > 0)
+        {
+            int i = stack[--top];
+            int x = i%roi.width, y = i/roi.width;
+            tileCount++;
+
+            for (int dy = -1; dy <= 1; dy++)
+            {
+                for (int dx = -1; dx <= 1; dx++)
+                {
+                    int nx = x + dx, ny = y + dy;
+                    if (nx < 0 || ny < 0 || nx >= roi.width || ny >= roi.height || seen[ny*roi.width + nx] ||
+                        tiles[(roi.y + ny)*COLUMNS + roi.x + nx].bw < ROI_THRESHOLD)
+                    {
+                        continue;
+                    }
+                    seen[ny*roi.width + nx] = 1;
+                    stack[top++] = ny*roi.width + nx;
+                }
+            }
+        }
+
+        components++;
+        *largest = MAX(*largest, tileCount);
+    }
+
+    free(seen);
+    free(stack);
+    return components;
+}
+
+RoiStats QueryRoi(const RoiTable *table, const Tile *tiles, Roi roi)
+{
+    RoiStats result = {0};
+    roi = ClipRoi(roi);
+    result.tiles = roi.width*roi.height;
+    if (result.tiles == 0)
+    {
+        return result;
+    }
+
+    result.meanShade = (float)RoiShadeSum(table, roi)/result.tiles;
+    result.covered = RoiCoveredCount(table, roi);
+    result.coverage = (float)result.covered/result.tiles;
+    if (result.covered > 0)
+    {
+        result.components = RoiComponents(tiles, roi, &result.largest);
+    }
+    return result;
+}
@@ -0,0 +1,1047 @@
+#include <stdlib.h>
+#include <string.h>         // For memcpy
+#include <time.h>           // For the tick counter
+#include <unistd.h>         // For the core count
+
+#include "sim.h"
+
+
+Arena stateArena;
+
+Agents agents;
+
+// Per step agent scratch
+float *steeringStrengths;
+float *newXPos;
+float *newYPos;
+
+Tile *grid;                     // Spare tile so 4 byte gathers of the last tile stay inside
+Tile *tempGrid;
+float *blurField;               // Diffused shades before the lerp
+uint32_t *depositField;
+
+// Splat scratch, four tiles and weights per agent
+int (*splatIndex)[N_AGENTS];
+uint32_t (*splatWeight)[N_AGENTS];
+
+Mip gridMip;
+Mip attractMip;
+int senseMip = SENSOR_SIZE >= MIP_SENSE_SIZE;
+
+uint64_t simStep = 0;
+uint64_t blockStep[DIRTY_BLOCKS];
+
+Stats stats;
+Trace trace;
+
+Params params = {TURN_SPEED, SENSOR_SCOPE, EVAPORATE_SPEED, DIFFUSE_SPEED, DEPOSIT_AMOUNT};
+int depositMode = DEPOSIT_TILE;
+
+const Palette palettes[] = {
+    {"slime",   2, {{0, 0, 0}, {0.2, 0.6, 0.9}}},
+    {"grey",    2, {{0, 0, 0}, {1, 1, 1}}},
+    {"fire",    4, {{0, 0, 0}, {0.5, 0, 0}, {1, 0.5, 0}, {1, 1, 0.8}}},
+    {"ice",     3, {{0, 0, 0}, {0.1, 0.2, 0.6}, {0.8, 1, 1}}},
+    {"viridis", 5, {{0.27, 0, 0.33}, {0.23, 0.32, 0.55}, {0.13, 0.57, 0.55}, {0.37, 0.79, 0.38}, {0.99, 0.91, 0.14}}},
+};
+const int paletteCount = sizeof(palettes)/sizeof(palettes[0]);
+
+int paletteIndex = 0;
+uint32_t paletteLUT[256];
+
+AgentKernel agentKernel = AgentKernelScalar;
+
+uint64_t randomState = 1;
+
+
+void CarveState(Arena *arena)
+{
+    // Every per run array, in one place so measuring and allocating cannot disagree
+    agents.xPos = ArenaAlloc(arena, sizeof(float)*N_AGENTS);
+    agents.yPos = ArenaAlloc(arena, sizeof(float)*N_AGENTS);
+    agents.angle = ArenaAlloc(arena, sizeof(float)*N_AGENTS);
+    agents.speed = ArenaAlloc(arena, sizeof(float)*N_AGENTS);
+    agents.xPrev = ArenaAlloc(arena, sizeof(float)*N_AGENTS*TAIL_LENGTH);
+    agents.yPrev = ArenaAlloc(arena, sizeof(float)*N_AGENTS*TAIL_LENGTH);
+
+    steeringStrengths = ArenaAlloc(arena, sizeof(float)*N_AGENTS);
+    newXPos = ArenaAlloc(arena, sizeof(float)*N_AGENTS);
+    newYPos = ArenaAlloc(arena, sizeof(float)*N_AGENTS);
+    splatIndex = ArenaAlloc(arena, sizeof(int)*4*N_AGENTS);
+    splatWeight = ArenaAlloc(arena, sizeof(uint32_t)*4*N_AGENTS);
+
+    grid = ArenaAlloc(arena, sizeof(Tile)*(GRID_SIZE + 1));
+    tempGrid = ArenaAlloc(arena, sizeof(Tile)*(GRID_SIZE + 1));   // Swapped with grid every step
+    blurField = ArenaAlloc(arena, sizeof(float)*(GRID_SIZE));
+    depositField = ArenaAlloc(arena, sizeof(uint32_t)*(GRID_SIZE));
+
+    CarveDiffusion(arena);
+}
+
+int CreateState()
+{
+    // Sized by a dry run without memory, then carved for real
+    Arena measure = {0};
+    CarveState(&measure);
+
+    if (CreateArena(&stateArena, measure.used) != 0)
+    {
+        return -1;
+    }
+    CarveState(&stateArena);
+    return 0;
+}
+
+void ResetState()
+{
+    // A new run is one clear of the arena, nothing is allocated again.
+    // Split over the cores so first touch spreads big states over the memory nodes
+    int parts = MIN(sysconf(_SC_NPROCESSORS_ONLN), (long)(stateArena.used/ARENA_HUGE_PAGE));
+    ResetArena(&stateArena, parts);
+}
+
+uint64_t Ticks()
+{
+    // Monotonic nanoseconds, works without SDL
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec*TICKS_PER_SECOND + now.tv_nsec;
+}
+
+float Lerp(float a, float b, float f)
+{
+    return a + f * (b - a);
+}
+
+void SeedRandom(uint64_t seed)
+{
+    randomState = seed;
+}
+
+uint32_t RandomAt(uint64_t state, uint64_t n)
+{
+    // splitmix64, draw n after state without stepping through the ones before
+    uint64_t z = state + (n + 1)*RANDOM_GAMMA;
+    z = (z ^ (z >> 30))*0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27))*0x94d049bb133111ebull;
+    return (z ^ (z >> 31)) >> 32;
+}
+
+uint32_t Random()
+{
+    // Unlike rand() the sequence is the same on every platform
+    uint32_t value = RandomAt(randomState, 0);
+    randomState += RANDOM_GAMMA;
+    return value;
+}
+
+float Rand01()
+{
+    return (float)(Random()%1000)/1000;
+}
+
+void ChangeShade(int x, int y, uint8_t bw)
+{
+    // Finding apropriate rectangle
+    Tile *tile = &tempGrid[y*COLUMNS + x];
+    if (tile->changed == 0)
+    {
+        //printf("hello\n");
+        tile->bw = bw;
+    }
+    tile->changed = 1;
+}
+
+void ChangeShadeBlur(int i, uint8_t bw)
+{
+    // Finding apropriate rectangle
+    Tile *tile = &tempGrid[i];
+    if (tile->changed == 0)
+    {
+        tile->bw = bw;
+    }
+    else
+    {
+        tile->bw = MAX(tile->bw, bw);
+    }
+    tile->changed = 1;
+}
+
+void SwapGrids()
+{
+    // Blur writes every tile of the next field, so the old one is reused instead of copied
+    Tile *next = grid;
+    grid = tempGrid;
+    tempGrid = next;
+
+    gridMip.tiles = grid;
+}
+
+void MarkChangedBlocks()
+{
+    // Blocks whose shade changed this step, for the renderer and the pyramid
+    for (int y = 0; y < ROWS; y++)
+    {
+        uint64_t *blockRow = &blockStep[(y/DIRTY_BLOCK)*DIRTY_COLUMNS];
+        for (int x = 0; x < COLUMNS; x++)
+        {
+            if (tempGrid[y*COLUMNS + x].bw != grid[y*COLUMNS + x].bw)
+            {
+                blockRow[x/DIRTY_BLOCK] = simStep;
+            }
+        }
+    }
+}
+
+void ResetUpdate()
+{
+    MarkChangedBlocks();
+
+    // Updates grid
+    SwapGrids();
+
+    int active = 0;
+    int sum = 0;
+
+    //Resets rectangles in grid
+    for (int i = 0; i < GRID_SIZE; i++)
+    {
+        tempGrid[i].changed = 0;
+
+        // Field stats while the tile is at hand
+        active += grid[i].bw > 0;
+        sum += grid[i].bw;
+    }
+
+    stats.activeTiles = active;
+    stats.meanShade = (float)sum/(GRID_SIZE);
+}
+
+void ResetUpdateQuick()
+{
+    // Steps inside a batch, only pyramid sensing looks at changed blocks before the last one
+    if (senseMip)
+    {
+        MarkChangedBlocks();
+    }
+    SwapGrids();
+    for (int i = 0; i < GRID_SIZE; i++)
+    {
+        tempGrid[i].changed = 0;
+    }
+}
+
+void UpdateTail(float *xPrev, float *yPrev, float xOld, float yOld)
+{
+    for (int i = TAIL_LENGTH-1; i > 0; i--)
+    {
+        xPrev[i] = xPrev[i-1];
+        yPrev[i] = yPrev[i-1];
+    }
+
+    xPrev[0] = xOld;
+    yPrev[0] = yOld;
+}
+
+void CreateMip(Mip *mip, const Tile *tiles, const uint8_t *map, const uint64_t *blocks)
+{
+    mip->tiles = tiles;
+    mip->map = map;
+    mip->blocks = blocks;
+    mip->levels[0] = (MipLevel){COLUMNS, ROWS, NULL};
+
+    float *data = mip->data;
+    for (int level = 1; level < MIP_LEVELS; level++)
+    {
+        // Rounding up so edge tiles are kept
+        int width = (mip->levels[level-1].width + 1)/2;
+        int height = (mip->levels[level-1].height + 1)/2;
+
+        mip->levels[level] = (MipLevel){width, height, data};
+        mip->built[level] = 0;
+        data += width*height;
+    }
+}
+
+float MipValue(const Mip *mip, int level, int x, int y)
+{
+    if (level == 0)
+    {
+        return mip->tiles != NULL ? mip->tiles[y*COLUMNS + x].bw : mip->map[y*COLUMNS + x];
+    }
+    return mip->levels[level].data[y*mip->levels[level].width + x];
+}
+
+void UpdateMip(Mip *mip, int level, uint64_t step)
+{
+    // Only cells above blocks changed since the level was built are redone, a static map is built once
+    for (int l = 1; l <= level; l++)
+    {
+        MipLevel *fine = &mip->levels[l-1];
+        MipLevel *coarse = &mip->levels[l];
+
+        for (int b = 0; b < DIRTY_BLOCKS; b++)
+        {
+            if (mip->blocks != NULL ? mip->blocks[b] <= mip->built[l] : mip->built[l] != 0)
+            {
+                continue;
+            }
+
+            // Cells over the block, rounded outwards once cells are larger than blocks
+            int x0 = ((b % DIRTY_COLUMNS)*DIRTY_BLOCK) >> l;
+            int y0 = ((b/DIRTY_COLUMNS)*DIRTY_BLOCK) >> l;
+            int x1 = MIN(coarse->width, ((b % DIRTY_COLUMNS + 1)*DIRTY_BLOCK + (1 << l) - 1) >> l);
+            int y1 = MIN(coarse->height, ((b/DIRTY_COLUMNS + 1)*DIRTY_BLOCK + (1 << l) - 1) >> l);
+
+            for (int y = y0; y < y1; y++)
+            {
+                for (int x = x0; x < x1; x++)
+                {
+                    float sum = 0;
+                    int count = 0;
+
+                    // Averaging the 2x2 block below, edge blocks can be smaller
+                    for (int fy = 2*y; fy < MIN(2*y + 2, fine->height); fy++)
+                    {
+                        for (int fx = 2*x; fx < MIN(2*x + 2, fine->width); fx++)
+                        {
+                            sum += MipValue(mip, l-1, fx, fy);
+                            count++;
+                        }
+                    }
+
+                    coarse->data[y*coarse->width + x] = sum/count;
+                }
+            }
+        }
+
+        mip->built[l] = step;
+    }
+}
+
+float SampleMip(const Mip *mip, int level, float xPos, float yPos)
+{
+    const MipLevel *values = &mip->levels[level];
+
+    // Grid position to level position, bilinear between the 4 closest values
+    float x = xPos/(1 << level) - 0.5f;
+    float y = yPos/(1 << level) - 0.5f;
+
+    x = MIN(values->width - 1, MAX(0, x));
+    y = MIN(values->height - 1, MAX(0, y));
+
+    int x0 = (int)x;
+    int y0 = (int)y;
+    int x1 = MIN(values->width - 1, x0 + 1);
+    int y1 = MIN(values->height - 1, y0 + 1);
+
+    float top = Lerp(MipValue(mip, level, x0, y0), MipValue(mip, level, x1, y0), x - x0);
+    float bottom = Lerp(MipValue(mip, level, x0, y1), MipValue(mip, level, x1, y1), x - x0);
+
+    return Lerp(top, bottom, y - y0);
+}
+
+int SenseMipLevel()
+{
+    // Coarsest level with blocks no larger than the sensor
+    int level = 0;
+    while (level + 1 < MIP_LEVELS && (2 << level) <= 2*SENSOR_SIZE + 1)
+    {
+        level++;
+    }
+    return level;
+}
+
+void SinCos(float x, float *sinOut, float *cosOut)
+{
+    // Polynomial approximation, the SIMD kernels repeat these exact steps per lane
+    float ax = fabsf(x);
+
+    // Reducing to [-pi/4, pi/4] around an even multiple of pi/4
+    int octant = (int)(ax * 1.27323954473516f);
+    octant = (octant + 1) & ~1;
+    float y = (float)octant;
+    ax = ((ax - y*0.78515625f) - y*2.4187564849853515625e-4f) - y*3.77489497744594108e-8f;
+
+    float z = ax*ax;
+    float cosPoly = ((2.443315711809948e-5f*z - 1.388731625493765e-3f)*z + 4.166664568298827e-2f)*z*z - 0.5f*z + 1.0f;
+    float sinPoly = ((-1.9515295891e-4f*z + 8.3321608736e-3f)*z - 1.6666654611e-1f)*z*ax + ax;
+
+    // Octant decides which polynomial and sign goes where
+    int swap = (octant & 2) != 0;
+    int sinNegative = ((octant & 4) != 0) ^ (x < 0);
+    int cosNegative = ((octant + 2) & 4) != 0;
+
+    float sinVal = swap ? cosPoly : sinPoly;
+    float cosVal = swap ? sinPoly : cosPoly;
+
+    *sinOut = sinNegative ? -sinVal : sinVal;
+    *cosOut = cosNegative ? -cosVal : cosVal;
+}
+
+float Sense(float xPos, float yPos, float angle, float sensorAngleOffset)
+{
+    float sensorAngle = angle + sensorAngleOffset;
+
+    float sensorDirX, sensorDirY;
+    SinCos(sensorAngle, &sensorDirY, &sensorDirX);
+
+    if (senseMip)
+    {
+        // Mean of the sensor area from the pyramids times its size
+        int level = SenseMipLevel();
+        float sensorX = xPos + sensorDirX*SENSOR_OFFSET_DIST;
+        float sensorY = yPos + sensorDirY*SENSOR_OFFSET_DIST;
+
+        float mean = SampleMip(&gridMip, level, sensorX, sensorY);
+        if (attractMap.data != NULL)
+        {
+            mean += SampleMip(&attractMip, level, sensorX, sensorY);
+        }
+        return mean*(2*SENSOR_SIZE + 1)*(2*SENSOR_SIZE + 1);
+    }
+
+    int sensorCentreX = xPos + sensorDirX*SENSOR_OFFSET_DIST;
+    int sensorCentreY = yPos + sensorDirY*SENSOR_OFFSET_DIST;
+
+    int sum = 0;
+    if (attractMap.data != NULL)
+    {
+        sum = SenseMap(attractMap.data, sensorCentreX, sensorCentreY);
+    }
+
+    for (int offsetX = -SENSOR_SIZE; offsetX <= SENSOR_SIZE; offsetX++)
+    {
+        for (int offsetY = -SENSOR_SIZE; offsetY <= SENSOR_SIZE; offsetY++)
+        {
+            int posX = sensorCentreX + offsetX;
+            int posY = sensorCentreY + offsetY;
+
+            if (posX >= 0 && posX < COLUMNS && posY >= 0 && posY < ROWS)
+            {
+                sum += grid[posY*COLUMNS + posX].bw;
+            }
+        }
+    }
+
+    return sum;
+}
+
+float Steer(float weightForward, float weightLeft, float weightRight, float steeringStrength)
+{
+    // Comparisons as 0/1 values, so the decision is a select and not a branch
+    int forward = (weightForward > weightLeft) & (weightForward > weightRight);
+    int random = (weightForward < weightLeft) & (weightForward < weightRight);
+    int side = (weightLeft > weightRight) - (weightRight > weightLeft);     // 1 left, -1 right, 0 tie
+
+    float randomTurn = (steeringStrength - 0.5f) * 2;
+    float sideTurn = side * steeringStrength;
+
+    // Forward: no change, both sides stronger: turn randomly, otherwise towards stronger side
+    return (1 - forward) * (random * randomTurn + (1 - random) * sideTurn);
+}
+
+void AgentKernelScalar(int start, int end, const float *strength, float deltaTime, float *newX, float *newY)
+{
+    for (int i = start; i < end; i++)
+    {
+        // Calculate directions
+        float Xdirection, Ydirection;
+        SinCos(agents.angle[i], &Ydirection, &Xdirection);
+
+        // Calculate new position
+        newX[i] = agents.xPos[i] + Xdirection*agents.speed[i]*deltaTime;
+        newY[i] = agents.yPos[i] + Ydirection*agents.speed[i]*deltaTime;
+
+        // Following system
+        float weightForward = Sense(agents.xPos[i], agents.yPos[i], agents.angle[i], 0);
+        float weightLeft = Sense(agents.xPos[i], agents.yPos[i], agents.angle[i], params.sensorScope);
+        float weightRight = Sense(agents.xPos[i], agents.yPos[i], agents.angle[i], -params.sensorScope);
+
+        agents.angle[i] += Steer(weightForward, weightLeft, weightRight, strength[i]) * params.turnSpeed * deltaTime;
+    }
+}
+
+const char *SelectAgentKernel()
+{
+    // Pyramid sensing is scalar only
+    if (senseMip)
+    {
+        agentKernel = AgentKernelScalar;
+        return "scalar";
+    }
+
+#if defined(__x86_64__) || defined(__i386__)
+    if (__builtin_cpu_supports("avx2"))
+    {
+        agentKernel = AgentKernelAVX2;
+        return "avx2";
+    }
+    if (__builtin_cpu_supports("sse2"))
+    {
+        agentKernel = AgentKernelSSE;
+        return "sse2";
+    }
+#endif
+
+    agentKernel = AgentKernelScalar;
+    return "scalar";
+}
+
+int UseAgentKernel(const char *name)
+{
+    // Forcing a kernel so its trace can be compared against the scalar one
+    if (strcmp(name, "scalar") == 0)
+    {
+        agentKernel = AgentKernelScalar;
+        return 0;
+    }
+
+#if defined(__x86_64__) || defined(__i386__)
+    if (!senseMip)
+    {
+        if (strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2"))
+        {
+            agentKernel = AgentKernelAVX2;
+            return 0;
+        }
+        if (strcmp(name, "sse2") == 0 && __builtin_cpu_supports("sse2"))
+        {
+            agentKernel = AgentKernelSSE;
+            return 0;
+        }
+    }
+#endif
+
+    return -1;
+}
+
+int SetDeposit(const char *spec)
+{
+    // "tile", "add" or "splat", optionally ":AMOUNT"
+    char mode[16] = "";
+    float amount = params.depositAmount;
+    int read = sscanf(spec, "%15[a-z]:%f", mode, &amount);
+
+    if      (strcmp(mode, "tile") == 0)  depositMode = DEPOSIT_TILE;
+    else if (strcmp(mode, "add") == 0)   depositMode = DEPOSIT_ADD;
+    else if (strcmp(mode, "splat") == 0) depositMode = DEPOSIT_SPLAT;
+    else read = 0;
+
+    if (read < 1 || amount < 0 || amount > 255)
+    {
+        printf("Deposit has to be tile, add or splat, with an optional :AMOUNT up to 255, got %s\n", spec);
+        return -1;
+    }
+
+    params.depositAmount = amount;
+    return 0;
+}
+
+void Deposit(float xPos, float yPos)
+{
+    uint32_t amount = params.depositAmount*DEPOSIT_ONE;
+
+    if (depositMode == DEPOSIT_TILE)
+    {
+        ChangeShade((int)xPos, (int)yPos, params.depositAmount);
+    }
+    else if (depositMode == DEPOSIT_ADD)
+    {
+        depositField[(int)yPos*COLUMNS + (int)xPos] += amount;
+    }
+    else
+    {
+        // Tile centres are at .5, weights from the distance to the 4 around the position
+        float x = MIN(COLUMNS - 1.0f, MAX(0.0f, xPos - 0.5f));
+        float y = MIN(ROWS - 1.0f, MAX(0.0f, yPos - 0.5f));
+        int x0 = MIN(COLUMNS - 2, (int)x), y0 = MIN(ROWS - 2, (int)y);
+        float fx = x - x0, fy = y - y0;
+        int i = y0*COLUMNS + x0;
+
+        depositField[i] += (uint32_t)(amount*(1 - fx)*(1 - fy));
+        depositField[i + 1] += (uint32_t)(amount*fx*(1 - fy));
+        depositField[i + COLUMNS] += (uint32_t)(amount*(1 - fx)*fy);
+        depositField[i + COLUMNS + 1] += (uint32_t)(amount*fx*fy);
+    }
+}
+
+void DepositSegment(float xStart, float yStart, float xEnd, float yEnd)
+{
+    // Tiles strictly between the start and end tile, the start was deposited on the step before
+    int x0 = xStart, y0 = yStart, x1 = xEnd, y1 = yEnd;
+    int dx = x1 - x0, dy = y1 - y0;
+    int steps = MAX(abs(dx), abs(dy));
+
+    for (int k = 1; k < steps; k++)
+    {
+        int x = floorf(x0 + 0.5f + (float)dx*k/steps);
+        int y = floorf(y0 + 0.5f + (float)dy*k/steps);
+        Deposit(x + 0.5f, y + 0.5f);
+    }
+}
+
+void DepositAgents(int start, int end)
+{
+    if (depositMode != DEPOSIT_SPLAT)
+    {
+        for (int i = start; i < end; i++)
+        {
+            Deposit(agents.xPos[i], agents.yPos[i]);
+        }
+        return;
+    }
+
+    // Indices and weights in straight lines over the agent arrays so they vectorise
+    float amount = params.depositAmount*DEPOSIT_ONE;
+    for (int i = start; i < end; i++)
+    {
+        float x = MIN(COLUMNS - 1.0f, MAX(0.0f, agents.xPos[i] - 0.5f));
+        float y = MIN(ROWS - 1.0f, MAX(0.0f, agents.yPos[i] - 0.5f));
+        int x0 = MIN(COLUMNS - 2, (int)x), y0 = MIN(ROWS - 2, (int)y);
+        float fx = x - x0, fy = y - y0;
+        int index = y0*COLUMNS + x0;
+
+        splatIndex[0][i] = index;
+        splatIndex[1][i] = index + 1;
+        splatIndex[2][i] = index + COLUMNS;
+        splatIndex[3][i] = index + COLUMNS + 1;
+        splatWeight[0][i] = amount*(1 - fx)*(1 - fy);
+        splatWeight[1][i] = amount*fx*(1 - fy);
+        splatWeight[2][i] = amount*(1 - fx)*fy;
+        splatWeight[3][i] = amount*fx*fy;
+    }
+
+    // Only the scatter is serial, integer sums let ranges be added in any order
+    for (int corner = 0; corner < 4; corner++)
+    {
+        for (int i = start; i < end; i++)
+        {
+            depositField[splatIndex[corner][i]] += splatWeight[corner][i];
+        }
+    }
+}
+
+void ApplyDeposits()
+{
+    if (depositMode == DEPOSIT_TILE)
+    {
+        return;
+    }
+
+    // Added on top of the current shade, blurring then keeps whichever is brighter
+    for (int i = 0; i < GRID_SIZE; i++)
+    {
+        if (depositField[i] != 0)
+        {
+            uint32_t shade = grid[i].bw + (depositField[i] + DEPOSIT_ONE/2)/DEPOSIT_ONE;
+            ChangeShadeBlur(i, MIN(255, shade));
+            depositField[i] = 0;
+        }
+    }
+}
+
+void AgentUpdate(double deltaTime)
+{
+    if (senseMip)
+    {
+        // The grid holds the field after the last step, so the pyramid is built up to it
+        UpdateMip(&gridMip, SenseMipLevel(), simStep - 1);
+        if (attractMap.data != NULL && attractMip.map != attractMap.data)
+        {
+            CreateMip(&attractMip, NULL, attractMap.data, NULL);
+        }
+        if (attractMap.data != NULL)
+        {
+            UpdateMip(&attractMip, SenseMipLevel(), simStep);
+        }
+    }
+
+    // Update previous positions, once per step whatever the sub-steps
+    float maxSpeed = 0;
+    for (int i = 0; i < N_AGENTS; i++)
+    {
+        UpdateTail(agents.xPrev[i], agents.yPrev[i], agents.xPos[i], agents.yPos[i]);
+        maxSpeed = MAX(maxSpeed, agents.speed[i]);
+    }
+
+    // Long steps are split so no agent moves more than a tile at a time
+    int substeps = MAX(1, (int)ceil(maxSpeed*deltaTime/AGENT_MAX_STEP));
+    substeps = MIN(substeps, AGENT_MAX_SUBSTEPS);
+    double subDelta = deltaTime/substeps;
+
+    for (int substep = 0; substep < substeps; substep++)
+    {
+        // Random numbers are drawn up front so the kernels can run agents in any order
+        for (int i = 0; i < N_AGENTS; i++)
+        {
+            steeringStrengths[i] = Rand01();
+        }
+
+        agentKernel(0, N_AGENTS, steeringStrengths, subDelta, newXPos, newYPos);
+
+        for (int i = 0; i < N_AGENTS; i++)
+        {
+            // Check for collision with boundary, exactly COLUMNS or ROWS is already off the grid
+            if (newXPos[i] < 0 || newXPos[i] >= COLUMNS || newYPos[i] < 0 || newYPos[i] >= ROWS)
+            {
+                newXPos[i] = MIN(COLUMNS-0.01, MAX(0, newXPos[i]));
+                newYPos[i] = MIN(ROWS-0.01, MAX(0, newYPos[i]));
+
+                // Calculate new direction
+                agents.angle[i] = 2 * M_PI * Rand01();
+                stats.collisions++;
+            }
+
+            // Obstacles are bounced off like the boundary, from where the agent was.
+            // Only moves entering one from outside, so an agent that started inside can walk out
+            if (obstacleMap.data != NULL && obstacleMap.data[(int)newYPos[i]*COLUMNS + (int)newXPos[i]] >= MAP_OBSTACLE &&
+                obstacleMap.data[(int)agents.yPos[i]*COLUMNS + (int)agents.xPos[i]] < MAP_OBSTACLE)
+            {
+                newXPos[i] = agents.xPos[i];
+                newYPos[i] = agents.yPos[i];
+                agents.angle[i] = 2 * M_PI * Rand01();
+                stats.collisions++;
+            }
+
+            // Trail along the whole move, not only where it ends
+            DepositSegment(agents.xPos[i], agents.yPos[i], newXPos[i], newYPos[i]);
+
+            agents.xPos[i] = newXPos[i];        // Setting new x postion
+            agents.yPos[i] = newYPos[i];        // Setting new y position
+        }
+
+        DepositAgents(0, N_AGENTS);
+    }
+
+    ApplyDeposits();
+}
+
+void Blur(double deltaTime)
+{
+    // Looping over agents
+    for (int i = 0; i < N_AGENTS; i++)
+    {
+        // Looping over previous positions
+        for (int j = 0; j < TAIL_LENGTH; j++)
+        {
+            // Checking if previous position has been recorded
+            if(agents.xPrev[i][j] != -1 && agents.yPrev[i][j] != -1)
+            {
+                // Change shade for previous agent position
+                int grid_index = (int)agents.yPrev[i][j]*COLUMNS + (int)agents.xPrev[i][j];
+                float bw = grid[grid_index].bw-params.evaporateSpeed*deltaTime;
+                ChangeShadeBlur(grid_index, MAX(0, bw));
+            }
+        }
+    }
+
+
+    // Neighbourhood of every tile from the selected kernel
+    Diffuse(grid, blurField);
+
+    // Long steps blur all the way instead of extrapolating past the blurred value
+    float diffuse = MIN(1.0, MAX(0.0, params.diffuseSpeed*deltaTime));
+
+    // Looping over grid
+    for (int i = 0; i < GRID_SIZE; i++)
+    {
+        float origionalVal = (float)(grid[i].bw);
+        float blurVal = blurField[i];
+
+        float diffusedVal = Lerp(origionalVal, blurVal, diffuse);
+
+        // Kept to what a shade can hold before converting
+        float diffusedEvaporatedVal = MIN(255, MAX(0, diffusedVal - params.evaporateSpeed*deltaTime));
+
+        ChangeShadeBlur(i, diffusedEvaporatedVal);
+    }
+}
+
+void UpdateSteps(double deltaTime, int steps)
+{
+    for (int k = 0; k < steps; k++)
+    {
+        // Reloaded parameters only ever change between steps
+        ApplyParams();
+        simStep++;
+
+        uint64_t start = Ticks();
+        AgentUpdate(deltaTime);
+        DepositFood();
+
+        uint64_t agentEnd = Ticks();
+        Blur(deltaTime);
+
+        uint64_t blurEnd = Ticks();
+        if (k + 1 < steps)
+        {
+            ResetUpdateQuick();
+        }
+        else
+        {
+            ResetUpdate();
+        }
+
+        uint64_t end = Ticks();
+
+        stats.agentTime += agentEnd - start;
+        stats.blurTime += blurEnd - agentEnd;
+        stats.resetTime += end - blurEnd;
+        stats.agentSteps += N_AGENTS;
+        stats.updates++;
+
+        if (trace.file != NULL && simStep % trace.interval == 0)
+        {
+            fprintf(trace.file, "%llu,%016llx\n", (unsigned long long)simStep, (unsigned long long)HashState());
+        }
+    }
+
+    // Blocks changed by the skipped steps are not known, all of them are new to the renderer
+    if (steps > 1)
+    {
+        for (int i = 0; i < DIRTY_BLOCKS; i++)
+        {
+            blockStep[i] = simStep;
+        }
+    }
+}
+
+void Update(double deltaTime)
+{
+    UpdateSteps(deltaTime, 1);
+}
+
+void OpenStats()
+{
+    stats.lastLoop = Ticks();
+
+    stats.log = fopen(STATS_FILE, "w");
+    if (stats.log == NULL)
+    {
+        printf("Could not open %s, stats are not logged\n", STATS_FILE);
+        return;
+    }
+    fprintf(stats.log, "seconds,agent_steps_per_sec,step_ms,agent_ms,blur_ms,reset_ms,collisions,active_tiles,mean_shade,huge_pages\n");
+}
+
+void SampleStats()
+{
+    uint64_t now = Ticks();
+    stats.loopTime += now - stats.lastLoop;
+    stats.lastLoop = now;
+    stats.loops++;
+
+    if (stats.loops < STATS_INTERVAL)
+    {
+        return;
+    }
+
+    // Averages over the sample
+    double frequency = TICKS_PER_SECOND;
+    double seconds = stats.loopTime/frequency;
+    double stepsPerSec = stats.agentSteps/seconds;
+    double stepMs = 1000*seconds/MAX(1, stats.updates);
+    int updates = MAX(1, stats.updates);
+    double agentMs = 1000*stats.agentTime/frequency/updates;
+    double blurMs = 1000*stats.blurTime/frequency/updates;
+    double resetMs = 1000*stats.resetTime/frequency/updates;
+
+    snprintf(stats.lines[0], 64, "agent steps/s %.3g", stepsPerSec);
+    snprintf(stats.lines[1], 64, "step      %7.2f ms", stepMs);
+    snprintf(stats.lines[2], 64, " agents   %7.2f ms", agentMs);
+    snprintf(stats.lines[3], 64, " blur     %7.2f ms", blurMs);
+    snprintf(stats.lines[4], 64, " reset    %7.2f ms", resetMs);
+    snprintf(stats.lines[5], 64, "collisions %llu", (unsigned long long)stats.collisions);
+    snprintf(stats.lines[6], 64, "active tiles %d", stats.activeTiles);
+    snprintf(stats.lines[7], 64, "mean shade %.2f", stats.meanShade);
+
+    // Transparent huge pages can be handed out later, so this is sampled too
+    stats.hugePages = CountHugePages(&stateArena);
+    snprintf(stats.lines[8], 64, "huge pages %d of %zu", stats.hugePages, stateArena.size/ARENA_HUGE_PAGE);
+
+    if (stats.log != NULL)
+    {
+        fprintf(stats.log, "%.3f,%.0f,%.3f,%.3f,%.3f,%.3f,%llu,%d,%.3f,%d\n",
+                now/frequency, stepsPerSec, stepMs, agentMs, blurMs, resetMs,
+                (unsigned long long)stats.collisions, stats.activeTiles, stats.meanShade, stats.hugePages);
+        fflush(stats.log);
+    }
+
+    // Starting next sample
+    stats.agentSteps = 0;
+    stats.collisions = 0;
+    stats.agentTime = 0;
+    stats.blurTime = 0;
+    stats.resetTime = 0;
+    stats.loopTime = 0;
+    stats.updates = 0;
+    stats.loops = 0;
+}
+
+void CloseStats()
+{
+    if (stats.log != NULL)
+    {
+        fclose(stats.log);
+    }
+}
+
+uint64_t HashWords(uint64_t hash, const void *data, size_t size)
+{
+    // FNV-1a over 4 byte words, sizes here are all multiples of 4
+    const uint8_t *bytes = data;
+    for (size_t i = 0; i + 4 <= size; i += 4)
+    {
+        uint32_t word;
+        memcpy(&word, bytes + i, 4);
+        hash = (hash ^ word)*0x100000001b3ull;
+    }
+    return hash;
+}
+
+uint64_t HashState()
+{
+    // Shades and agent positions, the tails only matter through the shades
+    static uint8_t shades[GRID_SIZE];
+    for (int i = 0; i < GRID_SIZE; i++)
+    {
+        shades[i] = grid[i].bw;
+    }
+
+    uint64_t hash = HASH_SEED;
+    hash = HashWords(hash, shades, sizeof(shades));
+    hash = HashWords(hash, agents.xPos, sizeof(float)*N_AGENTS);
+    hash = HashWords(hash, agents.yPos, sizeof(float)*N_AGENTS);
+    hash = HashWords(hash, agents.angle, sizeof(float)*N_AGENTS);
+    return hash;
+}
+
+int OpenTrace(const char *path, int interval)
+{
+    trace.interval = interval;
+    trace.file = fopen(path, "w");
+    if (trace.file == NULL)
+    {
+        printf("Could not open %s\n", path);
+        return -1;
+    }
+    fprintf(trace.file, "step,hash\n");
+    return 0;
+}
+
+void CloseTrace()
+{
+    if (trace.file != NULL)
+    {
+        fclose(trace.file);
+        trace.file = NULL;
+    }
+}
+
+void CreateGrid()
+{
+    ResetState();
+
+    for (int i = 0; i < GRID_SIZE; i++)
+    {
+        Tile tile = {BG_SHADE, 0};
+
+        tempGrid[i] = tile;
+        grid[i] = tile;
+    }
+
+    // Everything is new to the renderer
+    simStep++;
+    for (int i = 0; i < DIRTY_BLOCKS; i++)
+    {
+        blockStep[i] = simStep;
+    }
+
+    CreateMip(&gridMip, grid, NULL, blockStep);
+    SetPalette(paletteIndex);
+}
+
+void SetPalette(int index)
+{
+    const Palette *palette = &palettes[index];
+    paletteIndex = index;
+
+    // Built once per palette, color mapping is then one lookup per tile
+    for (int shade = 0; shade < 256; shade++)
+    {
+        float position = (float)shade/255*(palette->stops - 1);
+        int stop = MIN(palette->stops - 2, (int)position);
+        float f = position - stop;
+
+        uint32_t color = 0xFF000000;
+        for (int c = 0; c < 3; c++)
+        {
+            float value = Lerp(palette->colors[stop][c], palette->colors[stop + 1][c], f);
+            color |= (uint32_t)(uint8_t)(value*255) << (16 - 8*c);
+        }
+        paletteLUT[shade] = color;
+    }
+}
+
+int FindPalette(const char *name)
+{
+    for (int i = 0; i < paletteCount; i++)
+    {
+        if (strcmp(palettes[i].name, name) == 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void WriteImage(const char *path)
+{
+    FILE *file = fopen(path, "wb");
+    if (file == NULL)
+    {
+        printf("Could not write %s\n", path);
+        return;
+    }
+
+    // Binary PPM with the same colors as the window
+    fprintf(file, "P6\n%d %d\n255\n", COLUMNS, ROWS);
+    for (int i = 0; i < GRID_SIZE; i++)
+    {
+        uint32_t color = paletteLUT[grid[i].bw];
+        uint8_t rgb[3] = {color >> 16, color >> 8, color};
+        fwrite(rgb, 1, 3, file);
+    }
+
+    fclose(file);
+}
+
+void CreateFrameBuffers(FrameBuffers *buffers)
+{
+    buffers->back = 0;
+    buffers->front = 1;
+    atomic_store(&buffers->middle, 2);
+}
+
+void PublishFrame(FrameBuffers *buffers)
+{
+    Frame *frame = &buffers->frames[buffers->back];
+    memcpy(frame->tiles, grid, sizeof(frame->tiles));
+    memcpy(frame->blockStep, blockStep, sizeof(frame->blockStep));
+    memcpy(frame->statsLines, stats.lines, sizeof(frame->statsLines));
+    frame->step = simStep;
+
+    // Finished frame becomes the middle one, the old middle is written next
+    buffers->back = atomic_exchange(&buffers->middle, buffers->back | FRAME_FRESH) & ~FRAME_FRESH;
+}
+
+const Frame *AcquireFrame(FrameBuffers *buffers)
+{
+    // Swapping in the newest frame if one was published since last time
+    if (atomic_load(&buffers->middle) & FRAME_FRESH)
+    {
+        buffers->front = atomic_exchange(&buffers->middle, buffers->front) & ~FRAME_FRESH;
+    }
+    return &buffers->frames[buffers->front];
+}
@@ -0,0 +1,450 @@
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdio.h>          // Standard input output library
+#include <stdint.h>         // Fixed size integers
+#include <math.h>           // For mathematical functions
+#include <stdatomic.h>      // For handing frames between threads
+
+
+#define MAX(x, y) ((x > y) ? x : y)
+#define MIN(x, y) ((x < y) ? x : y)
+
+// Window Values
+#define CAM_WIDTH 1280      // Possible Values: 640, 1280
+#define CAM_HEIGHT 840      // Possible Values: 320, 840
+
+// Grid Values
+#define RECT_WIDTH 2
+#define RECT_HEIGHT 2
+
+#define ROWS CAM_HEIGHT/RECT_HEIGHT
+#define COLUMNS CAM_WIDTH/RECT_WIDTH
+
+#define GRID_SIZE  ROWS*COLUMNS
+
+#define BG_SHADE 0
+
+typedef struct Tile
+{
+    uint8_t bw;
+    char changed;
+} Tile;
+
+// Agent Values
+#define N_AGENTS 10000
+#define SPEED 0.05f
+#define AGENT_MAX_STEP 1.0f       // Longest move per sub-step, in tiles
+#define AGENT_MAX_SUBSTEPS 64
+
+// Affects the tail
+#define TAIL_LENGTH 300
+#define DIFFUSE_SPEED 0.015
+#define EVAPORATE_SPEED 0.2f
+
+// Diffusion kernels for the blur
+#define MAX_DIFFUSION_RADIUS 128
+#define DIFFUSION_BOX8 0        // 8 neighbours over 9, the original blur
+#define DIFFUSION_SEPARABLE 1   // Row then column weights
+#define DIFFUSION_LINE 2        // Taps along one direction
+
+#define DIFFUSION_AUTO 0        // Separable kernels, direct or FFT by radius
+#define DIFFUSION_DIRECT 1
+#define DIFFUSION_FFT 2
+#define DIFFUSION_FFT_RADIUS 88     // slime-bench crossover: direct wins at gauss:64, FFT at gauss:128
+#define FFT_MAX_SIZE 1024       // Longest line plus radius, rounded up to a power of 2
+
+typedef struct Diffusion
+{
+    char name[32];
+    int type;
+    int radiusX;
+    int radiusY;
+    float weightsX[2*MAX_DIFFUSION_RADIUS + 1];
+    float weightsY[2*MAX_DIFFUSION_RADIUS + 1];
+    float normsX[COLUMNS];      // 1 over the weight inside the grid per column
+    float normsY[ROWS];
+    int tapX[2*MAX_DIFFUSION_RADIUS + 1];
+    int tapY[2*MAX_DIFFUSION_RADIUS + 1];
+    int fft;                    // Separable passes in the frequency domain
+} Diffusion;
+
+// Affects the following system
+#define SENSOR_SCOPE M_PI/6
+#define TURN_SPEED 0.3f
+#define SENSOR_OFFSET_DIST 3
+#define SENSOR_SIZE 3
+
+// Parameters that can change without recompiling, defaults from above
+typedef struct Params
+{
+    float turnSpeed;
+    float sensorScope;
+    float evaporateSpeed;
+    float diffuseSpeed;
+    float depositAmount;
+} Params;
+
+#define PARAM_COUNT (int)(sizeof(Params)/sizeof(float))
+#define PARAMS_POLL_STEPS 50      // Headless steps between looks at a watched parameter file
+#define PARAMS_POLL_MS 250        // Same for the window
+
+// Parameter file checked for changes while running
+typedef struct ParamsWatch
+{
+    const char *path;
+    Params params;          // Last read, lines missing from the file keep these
+    long long modified;     // Nanoseconds
+    long long size;
+} ParamsWatch;
+
+// How agents leave their trail
+#define DEPOSIT_AMOUNT 255
+#define DEPOSIT_TILE 0        // Amount into the tile under the agent, first write of the step wins
+#define DEPOSIT_ADD 1         // Amount added to the tile under the agent
+#define DEPOSIT_SPLAT 2       // Amount shared bilinearly by the 4 closest tiles, added
+#define DEPOSIT_ONE 256       // Fixed point scale of the deposit field
+
+// Mip pyramid of the grid, level n averages 2^n x 2^n tiles
+#define MIP_LEVELS 6
+#define MIP_SENSE_SIZE 8      // Sensors this size or larger sample the pyramid
+
+typedef struct MipLevel
+{
+    int width;
+    int height;
+    float *data;            // Mean shade, level 0 reads the tiles directly
+} MipLevel;
+
+typedef struct Mip
+{
+    MipLevel levels[MIP_LEVELS];
+    const Tile *tiles;
+    const uint8_t *map;             // Level 0 of a static map pyramid, used when tiles is NULL
+    const uint64_t *blocks;         // Step each DIRTY_BLOCK block last changed at, NULL for a static map
+    uint64_t built[MIP_LEVELS];     // Step each level is up to date with, 0 before the first build
+    float data[GRID_SIZE/2];
+} Mip;
+
+// One array per field so agents can be processed in SIMD lanes, all N_AGENTS long in the state arena
+typedef struct Agents
+{
+    float *xPos;
+    float *yPos;
+    float *angle;
+    float *speed;
+
+    float (*xPrev)[TAIL_LENGTH];
+    float (*yPrev)[TAIL_LENGTH];
+} Agents;
+
+// Bump allocator that owns the simulation state
+#define ARENA_ALIGN 64                    // Cache line, also enough for any SIMD load
+#define ARENA_HUGE_PAGE (2*1024*1024)
+#define ARENA_MAX_ALLOCATIONS 32
+
+typedef struct Arena
+{
+    uint8_t *base;          // NULL while only measuring
+    size_t size;
+    size_t used;
+    int hugePages;          // Reserved huge pages, otherwise transparent ones are asked for
+    int count;
+    size_t offsets[ARENA_MAX_ALLOCATIONS];
+    size_t sizes[ARENA_MAX_ALLOCATIONS];
+} Arena;
+
+typedef struct ArenaPart
+{
+    Arena *arena;
+    int part;
+    int parts;
+} ArenaPart;
+
+// Moves and steers agents [start, end), writes new positions, leaves the grid alone
+typedef void (*AgentKernel)(int start, int end, const float *strength, float deltaTime, float *newX, float *newY);
+
+// Static map layers, one byte per tile
+#define MAP_OBSTACLE 128      // Obstacle map values from here up block agents
+
+typedef struct MapLayer
+{
+    const uint8_t *data;    // NULL when no map is loaded
+    void *mapping;          // Whole file mapping, NULL when data was copied
+    size_t mappingSize;
+} MapLayer;
+
+// Food sources and network extraction
+#define MAX_FOOD 64
+#define FOOD_RADIUS 3
+#define NETWORK_THRESHOLD 128   // Shades from here up are part of the network
+#define NETWORK_FILE "network.txt"
+
+typedef struct Food
+{
+    int x;
+    int y;
+} Food;
+
+// Region of interest Values
+#define MAX_ROIS 16
+#define ROI_THRESHOLD 128     // Shade a tile needs to count as covered, same as the networks
+#define ROI_INTERVAL 100      // Steps between logged queries
+#define ROI_FILE "roi.csv"
+#define ROI_LINES 4
+
+typedef struct Roi
+{
+    int x, y;               // Top left tile
+    int width, height;
+} Roi;
+
+// Running sums of the field, any rectangle sum is then 4 reads
+typedef struct RoiTable
+{
+    uint32_t shade[(ROWS + 1)*(COLUMNS + 1)];
+    uint32_t covered[(ROWS + 1)*(COLUMNS + 1)];
+    uint64_t step;          // Step the sums were last brought up to
+} RoiTable;
+
+typedef struct RoiStats
+{
+    int tiles;
+    float meanShade;
+    int covered;            // Tiles of ROI_THRESHOLD or more
+    float coverage;
+    int components;         // 8-connected groups of covered tiles
+    int largest;            // Tiles in the biggest one
+} RoiStats;
+
+// Spawn Values
+#define SPAWN_RADIUS 100
+#define SPAWN_THREAD_AGENTS 65536   // Agents per thread before spawning goes parallel
+
+// Stats Values
+#define STATS_INTERVAL 30     // Frames between samples
+#define STATS_FILE "stats.csv"
+#define STATS_LINES 9
+
+typedef struct Stats
+{
+    // Accumulated since last sample
+    uint64_t agentSteps;
+    uint64_t collisions;
+    uint64_t agentTime;     // Ticks per phase
+    uint64_t blurTime;
+    uint64_t resetTime;
+    uint64_t loopTime;
+    int updates;
+    int loops;              // Calls to SampleStats
+
+    // From the latest grid
+    int activeTiles;
+    float meanShade;
+
+    int hugePages;          // Backing the state arena
+
+    uint64_t lastLoop;
+    char lines[STATS_LINES][64];
+    FILE *log;
+} Stats;
+
+// Gradient palettes, stops evenly spaced from shade 0 to 255
+#define PALETTE_MAX_STOPS 5
+
+typedef struct Palette
+{
+    const char *name;
+    int stops;
+    float colors[PALETTE_MAX_STOPS][3];
+} Palette;
+
+// Changed tiles are tracked per block of DIRTY_BLOCK x DIRTY_BLOCK tiles
+#define DIRTY_BLOCK 32
+#define DIRTY_COLUMNS ((COLUMNS + DIRTY_BLOCK - 1)/DIRTY_BLOCK)
+#define DIRTY_ROWS ((ROWS + DIRTY_BLOCK - 1)/DIRTY_BLOCK)
+#define DIRTY_BLOCKS (DIRTY_COLUMNS*DIRTY_ROWS)
+
+// Finished fields handed from the simulation thread to the renderer without locks
+typedef struct Frame
+{
+    Tile tiles[GRID_SIZE];
+    uint64_t blockStep[DIRTY_BLOCKS];   // Step each block last changed at
+    uint64_t step;
+    char statsLines[STATS_LINES][64];
+} Frame;
+
+#define FRAME_FRESH 4       // Set on the middle index while it is newer than the front
+
+typedef struct FrameBuffers
+{
+    Frame frames[3];
+    int back;               // Only touched by the simulation
+    int front;              // Only touched by the renderer
+    _Atomic int middle;
+} FrameBuffers;
+
+// Deterministic runs, state hash every TRACE_INTERVAL steps
+#define TRACE_INTERVAL 100
+#define HASH_SEED 0xcbf29ce484222325ull   // FNV-1a offset basis
+
+typedef struct Trace
+{
+    FILE *file;
+    int interval;
+} Trace;
+
+#define RANDOM_GAMMA 0x9e3779b97f4a7c15ull   // splitmix64 step
+
+#define TICKS_PER_SECOND 1000000000ull
+
+#define DEFAULT_DELTA_TIME 2.0  // Fixed step for headless runs
+
+
+extern Agents agents;
+
+extern Arena stateArena;
+
+// In stateArena, N_AGENTS or GRID_SIZE long
+extern float *steeringStrengths;
+extern float *newXPos;
+extern float *newYPos;
+
+extern Tile *grid;          // GRID_SIZE + 1 long
+extern Tile *tempGrid;      // Same, the two are swapped every step
+extern uint32_t *depositField;  // Added deposits this step, integers so any order sums the same
+
+extern Mip gridMip;
+extern Mip attractMip;      // Of attractMap, built the first time pyramid sensing meets it
+extern int senseMip;        // Sensing reads the pyramids, on by default for sensors of MIP_SENSE_SIZE and up
+
+extern uint64_t randomState;
+extern uint64_t simStep;    // Updates since start
+extern uint64_t blockStep[DIRTY_BLOCKS];
+
+extern Stats stats;
+extern Trace trace;
+extern Params params;
+extern const char *const paramNames[PARAM_COUNT];
+extern const float paramLimits[PARAM_COUNT][2];
+extern const Palette palettes[];
+extern const int paletteCount;
+extern int paletteIndex;
+extern uint32_t paletteLUT[256];   // ARGB8888 per shade
+extern AgentKernel agentKernel;
+extern int depositMode;
+extern Diffusion diffusion;
+extern Food foods[MAX_FOOD];
+extern int foodCount;
+extern MapLayer attractMap;     // Added to the trails when sensing
+extern MapLayer obstacleMap;    // Tiles agents cannot enter
+
+// Simulation (sim.c)
+int CreateState();
+void ResetState();
+uint64_t Ticks();
+float Lerp(float a, float b, float f);
+void SeedRandom(uint64_t seed);
+uint32_t RandomAt(uint64_t state, uint64_t n);
+uint32_t Random();
+float Rand01();
+void ChangeShade(int x, int y, uint8_t bw);
+void ChangeShadeBlur(int i, uint8_t bw);
+void SwapGrids();
+void MarkChangedBlocks();
+void ResetUpdate();
+void ResetUpdateQuick();
+void UpdateTail(float *xPrev, float *yPrev, float xOld, float yOld);
+void CreateGrid();
+void CreateMip(Mip *mip, const Tile *tiles, const uint8_t *map, const uint64_t *blocks);
+float MipValue(const Mip *mip, int level, int x, int y);
+void UpdateMip(Mip *mip, int level, uint64_t step);
+float SampleMip(const Mip *mip, int level, float xPos, float yPos);
+void SinCos(float x, float *sinOut, float *cosOut);
+float Sense(float xPos, float yPos, float angle, float sensorAngleOffset);
+float Steer(float weightForward, float weightLeft, float weightRight, float steeringStrength);
+void AgentKernelScalar(int start, int end, const float *strength, float deltaTime, float *newX, float *newY);
+const char *SelectAgentKernel();
+int UseAgentKernel(const char *name);
+int SetDeposit(const char *spec);
+void Deposit(float xPos, float yPos);
+void DepositSegment(float xStart, float yStart, float xEnd, float yEnd);
+void DepositAgents(int start, int end);
+void ApplyDeposits();
+void AgentUpdate(double deltaTime);
+void Blur(double deltaTime);
+void UpdateSteps(double deltaTime, int steps);
+void Update(double deltaTime);
+void OpenStats();
+void SampleStats();
+void CloseStats();
+uint64_t HashWords(uint64_t hash, const void *data, size_t size);
+uint64_t HashState();
+int OpenTrace(const char *path, int interval);
+void CloseTrace();
+void SetPalette(int index);
+int FindPalette(const char *name);
+void WriteImage(const char *path);
+void CreateFrameBuffers(FrameBuffers *buffers);
+void PublishFrame(FrameBuffers *buffers);
+const Frame *AcquireFrame(FrameBuffers *buffers);
+
+// SIMD agent kernels (simd.c)
+void AgentKernelSSE(int start, int end, const float *strength, float deltaTime, float *newX, float *newY);
+void AgentKernelAVX2(int start, int end, const float *strength, float deltaTime, float *newX, float *newY);
+int CheckKernels();
+
+// Diffusion kernels (diffuse.c)
+void CarveDiffusion(Arena *arena);
+int SetDiffusion(const char *spec);
+void DiffuseSeparable(const Tile *tiles, float *field);
+void DiffuseFFT(const Tile *tiles, float *field);
+void Diffuse(const Tile *tiles, float *field);
+int CheckDiffusion();
+
+// State arena (arena.c)
+int CreateArena(Arena *arena, size_t size);
+void DestroyArena(Arena *arena);
+void *ArenaAlloc(Arena *arena, size_t size);
+void ResetArena(Arena *arena, int parts);
+int CountHugePages(const Arena *arena);
+
+// Attractor and obstacle maps (map.c)
+int LoadMap(MapLayer *layer, const char *path);
+void UnloadMap(MapLayer *layer);
+int SenseMap(const uint8_t *map, int centreX, int centreY);
+
+// Food and transport networks (network.c)
+int ParseFood(const char *text);
+void DepositFood();
+int ExtractNetwork(const Tile *tiles, const char *path);
+
+// Region of interest queries (roi.c)
+int ParseRoi(const char *text, Roi *roi);
+Roi ClipRoi(Roi roi);
+void UpdateRoiTable(RoiTable *table, const Tile *tiles, const uint64_t *blocks, uint64_t step);
+uint32_t RoiShadeSum(const RoiTable *table, Roi roi);
+uint32_t RoiCoveredCount(const RoiTable *table, Roi roi);
+int RoiComponents(const Tile *tiles, Roi roi, int *largest);
+RoiStats QueryRoi(const RoiTable *table, const Tile *tiles, Roi roi);
+
+// Parameter files and hot reloading (params.c)
+int FindParam(const char *name);
+int CheckParam(int p, float value);
+int ReadParams(const char *path, Params *out);
+void PublishParams(const Params *next);
+int ApplyParams();
+int WatchParams(ParamsWatch *watch, const char *path);
+int PollParams(ParamsWatch *watch);
+
+// Spawn patterns (spawn.c)
+int Spawn(const char *pattern);
+void ListSpawnPatterns();
+
+// Golden output checks (check.c)
+int CheckGolden(const char *path, int write);
+
+// Headless parameter sweeps (sweep.c)
+int RunSweep(const char *path);
+
+#endif
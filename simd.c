@@ -0,0 +1,322 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "sim.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>      // SSE and AVX2 intrinsics
+
+
+// SSE2 is always there on x86-64, 4 agents at a time with per lane loads
+void SinCos4(__m128 x, __m128 *sinOut, __m128 *cosOut)
+{
+    __m128 signMask = _mm_set1_ps(-0.0f);
+    __m128 ax = _mm_andnot_ps(signMask, x);
+
+    __m128i octant = _mm_cvttps_epi32(_mm_mul_ps(ax, _mm_set1_ps(1.27323954473516f)));
+    octant = _mm_and_si128(_mm_add_epi32(octant, _mm_set1_epi32(1)), _mm_set1_epi32(~1));
+    __m128 y = _mm_cvtepi32_ps(octant);
+    ax = _mm_sub_ps(ax, _mm_mul_ps(y, _mm_set1_ps(0.78515625f)));
+    ax = _mm_sub_ps(ax, _mm_mul_ps(y, _mm_set1_ps(2.4187564849853515625e-4f)));
+    ax = _mm_sub_ps(ax, _mm_mul_ps(y, _mm_set1_ps(3.77489497744594108e-8f)));
+
+    __m128 z = _mm_mul_ps(ax, ax);
+    __m128 cosPoly = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(2.443315711809948e-5f), z), _mm_set1_ps(-1.388731625493765e-3f));
+    cosPoly = _mm_add_ps(_mm_mul_ps(cosPoly, z), _mm_set1_ps(4.166664568298827e-2f));
+    cosPoly = _mm_mul_ps(_mm_mul_ps(cosPoly, z), z);
+    cosPoly = _mm_add_ps(_mm_sub_ps(cosPoly, _mm_mul_ps(_mm_set1_ps(0.5f), z)), _mm_set1_ps(1.0f));
+    __m128 sinPoly = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(-1.9515295891e-4f), z), _mm_set1_ps(8.3321608736e-3f));
+    sinPoly = _mm_add_ps(_mm_mul_ps(sinPoly, z), _mm_set1_ps(-1.6666654611e-1f));
+    sinPoly = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(sinPoly, z), ax), ax);
+
+    __m128 swap = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(octant, _mm_set1_epi32(2)), _mm_set1_epi32(2)));
+    __m128 sinVal = _mm_or_ps(_mm_and_ps(swap, cosPoly), _mm_andnot_ps(swap, sinPoly));
+    __m128 cosVal = _mm_or_ps(_mm_and_ps(swap, sinPoly), _mm_andnot_ps(swap, cosPoly));
+
+    // Sign bits from the octant and the sign of x
+    __m128 sinSign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(octant, _mm_set1_epi32(4)), 29));
+    sinSign = _mm_xor_ps(sinSign, _mm_and_ps(signMask, x));
+    __m128 cosSign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(_mm_add_epi32(octant, _mm_set1_epi32(2)), _mm_set1_epi32(4)), 29));
+
+    *sinOut = _mm_xor_ps(sinVal, sinSign);
+    *cosOut = _mm_xor_ps(cosVal, cosSign);
+}
+
+__m128 Sense4(__m128 xPos, __m128 yPos, __m128 angle, float sensorAngleOffset)
+{
+    __m128 sensorDirX, sensorDirY;
+    SinCos4(_mm_add_ps(angle, _mm_set1_ps(sensorAngleOffset)), &sensorDirY, &sensorDirX);
+
+    __m128 offsetDist = _mm_set1_ps(SENSOR_OFFSET_DIST);
+    int centreX[4], centreY[4];
+    _mm_storeu_si128((__m128i *)centreX, _mm_cvttps_epi32(_mm_add_ps(xPos, _mm_mul_ps(sensorDirX, offsetDist))));
+    _mm_storeu_si128((__m128i *)centreY, _mm_cvttps_epi32(_mm_add_ps(yPos, _mm_mul_ps(sensorDirY, offsetDist))));
+
+    // No gather in SSE, summing each lane on its own
+    int sum[4] = {0, 0, 0, 0};
+    for (int lane = 0; lane < 4; lane++)
+    {
+        if (attractMap.data != NULL)
+        {
+            sum[lane] = SenseMap(attractMap.data, centreX[lane], centreY[lane]);
+        }
+
+        for (int offsetY = -SENSOR_SIZE; offsetY <= SENSOR_SIZE; offsetY++)
+        {
+            int posY = centreY[lane] + offsetY;
+            if (posY < 0 || posY >= ROWS)
+            {
+                continue;
+            }
+
+            for (int offsetX = -SENSOR_SIZE; offsetX <= SENSOR_SIZE; offsetX++)
+            {
+                int posX = centreX[lane] + offsetX;
+                if (posX >= 0 && posX < COLUMNS)
+                {
+                    sum[lane] += grid[posY*COLUMNS + posX].bw;
+                }
+            }
+        }
+    }
+
+    return _mm_cvtepi32_ps(_mm_loadu_si128((__m128i *)sum));
+}
+
+__m128 Steer4(__m128 weightForward, __m128 weightLeft, __m128 weightRight, __m128 steeringStrength)
+{
+    __m128 one = _mm_set1_ps(1.0f);
+
+    __m128 forward = _mm_and_ps(_mm_and_ps(_mm_cmpgt_ps(weightForward, weightLeft), _mm_cmpgt_ps(weightForward, weightRight)), one);
+    __m128 random = _mm_and_ps(_mm_and_ps(_mm_cmplt_ps(weightForward, weightLeft), _mm_cmplt_ps(weightForward, weightRight)), one);
+    __m128 side = _mm_sub_ps(_mm_and_ps(_mm_cmpgt_ps(weightLeft, weightRight), one), _mm_and_ps(_mm_cmpgt_ps(weightRight, weightLeft), one));
+
+    __m128 randomTurn = _mm_mul_ps(_mm_sub_ps(steeringStrength, _mm_set1_ps(0.5f)), _mm_set1_ps(2.0f));
+    __m128 sideTurn = _mm_mul_ps(side, steeringStrength);
+
+    __m128 turn = _mm_add_ps(_mm_mul_ps(random, randomTurn), _mm_mul_ps(_mm_sub_ps(one, random), sideTurn));
+    return _mm_mul_ps(_mm_sub_ps(one, forward), turn);
+}
+
+void AgentKernelSSE(int start, int end, const float *strength, float deltaTime, float *newX, float *newY)
+{
+    __m128 dt = _mm_set1_ps(deltaTime);
+    __m128 turnSpeed = _mm_set1_ps(params.turnSpeed);
+
+    int i = start;
+    for (; i + 4 <= end; i += 4)
+    {
+        __m128 xPos = _mm_loadu_ps(&agents.xPos[i]);
+        __m128 yPos = _mm_loadu_ps(&agents.yPos[i]);
+        __m128 angle = _mm_loadu_ps(&agents.angle[i]);
+        __m128 speed = _mm_loadu_ps(&agents.speed[i]);
+
+        __m128 Xdirection, Ydirection;
+        SinCos4(angle, &Ydirection, &Xdirection);
+
+        _mm_storeu_ps(&newX[i], _mm_add_ps(xPos, _mm_mul_ps(_mm_mul_ps(Xdirection, speed), dt)));
+        _mm_storeu_ps(&newY[i], _mm_add_ps(yPos, _mm_mul_ps(_mm_mul_ps(Ydirection, speed), dt)));
+
+        __m128 weightForward = Sense4(xPos, yPos, angle, 0);
+        __m128 weightLeft = Sense4(xPos, yPos, angle, params.sensorScope);
+        __m128 weightRight = Sense4(xPos, yPos, angle, -params.sensorScope);
+
+        __m128 steer = Steer4(weightForward, weightLeft, weightRight, _mm_loadu_ps(&strength[i]));
+        _mm_storeu_ps(&agents.angle[i], _mm_add_ps(angle, _mm_mul_ps(_mm_mul_ps(steer, turnSpeed), dt)));
+    }
+
+    // Leftover agents
+    AgentKernelScalar(i, end, strength, deltaTime, newX, newY);
+}
+
+// AVX2, 8 agents at a time with the grid sampled by gathers
+__attribute__((target("avx2")))
+void SinCos8(__m256 x, __m256 *sinOut, __m256 *cosOut)
+{
+    __m256 signMask = _mm256_set1_ps(-0.0f);
+    __m256 ax = _mm256_andnot_ps(signMask, x);
+
+    __m256i octant = _mm256_cvttps_epi32(_mm256_mul_ps(ax, _mm256_set1_ps(1.27323954473516f)));
+    octant = _mm256_and_si256(_mm256_add_epi32(octant, _mm256_set1_epi32(1)), _mm256_set1_epi32(~1));
+    __m256 y = _mm256_cvtepi32_ps(octant);
+    ax = _mm256_sub_ps(ax, _mm256_mul_ps(y, _mm256_set1_ps(0.78515625f)));
+    ax = _mm256_sub_ps(ax, _mm256_mul_ps(y, _mm256_set1_ps(2.4187564849853515625e-4f)));
+    ax = _mm256_sub_ps(ax, _mm256_mul_ps(y, _mm256_set1_ps(3.77489497744594108e-8f)));
+
+    __m256 z = _mm256_mul_ps(ax, ax);
+    __m256 cosPoly = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(2.443315711809948e-5f), z), _mm256_set1_ps(-1.388731625493765e-3f));
+    cosPoly = _mm256_add_ps(_mm256_mul_ps(cosPoly, z), _mm256_set1_ps(4.166664568298827e-2f));
+    cosPoly = _mm256_mul_ps(_mm256_mul_ps(cosPoly, z), z);
+    cosPoly = _mm256_add_ps(_mm256_sub_ps(cosPoly, _mm256_mul_ps(_mm256_set1_ps(0.5f), z)), _mm256_set1_ps(1.0f));
+    __m256 sinPoly = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(-1.9515295891e-4f), z), _mm256_set1_ps(8.3321608736e-3f));
+    sinPoly = _mm256_add_ps(_mm256_mul_ps(sinPoly, z), _mm256_set1_ps(-1.6666654611e-1f));
+    sinPoly = _mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(sinPoly, z), ax), ax);
+
+    __m256 swap = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(octant, _mm256_set1_epi32(2)), _mm256_set1_epi32(2)));
+    __m256 sinVal = _mm256_blendv_ps(sinPoly, cosPoly, swap);
+    __m256 cosVal = _mm256_blendv_ps(cosPoly, sinPoly, swap);
+
+    // Sign bits from the octant and the sign of x
+    __m256 sinSign = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(octant, _mm256_set1_epi32(4)), 29));
+    sinSign = _mm256_xor_ps(sinSign, _mm256_and_ps(signMask, x));
+    __m256 cosSign = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(_mm256_add_epi32(octant, _mm256_set1_epi32(2)), _mm256_set1_epi32(4)), 29));
+
+    *sinOut = _mm256_xor_ps(sinVal, sinSign);
+    *cosOut = _mm256_xor_ps(cosVal, cosSign);
+}
+
+__attribute__((target("avx2")))
+__m256 Sense8(__m256 xPos, __m256 yPos, __m256 angle, float sensorAngleOffset)
+{
+    __m256 sensorDirX, sensorDirY;
+    SinCos8(_mm256_add_ps(angle, _mm256_set1_ps(sensorAngleOffset)), &sensorDirY, &sensorDirX);
+
+    __m256 offsetDist = _mm256_set1_ps(SENSOR_OFFSET_DIST);
+    __m256i centreX = _mm256_cvttps_epi32(_mm256_add_ps(xPos, _mm256_mul_ps(sensorDirX, offsetDist)));
+    __m256i centreY = _mm256_cvttps_epi32(_mm256_add_ps(yPos, _mm256_mul_ps(sensorDirY, offsetDist)));
+
+    __m256i zero = _mm256_setzero_si256();
+    __m256i columns = _mm256_set1_epi32(COLUMNS);
+    __m256i rows = _mm256_set1_epi32(ROWS);
+    __m256i shadeMask = _mm256_set1_epi32(0xFF);
+    __m256i sum = zero;
+
+    for (int offsetY = -SENSOR_SIZE; offsetY <= SENSOR_SIZE; offsetY++)
+    {
+        __m256i posY = _mm256_add_epi32(centreY, _mm256_set1_epi32(offsetY));
+        __m256i rowInside = _mm256_andnot_si256(_mm256_cmpgt_epi32(zero, posY), _mm256_cmpgt_epi32(rows, posY));
+        __m256i rowStart = _mm256_mullo_epi32(posY, columns);
+
+        for (int offsetX = -SENSOR_SIZE; offsetX <= SENSOR_SIZE; offsetX++)
+        {
+            __m256i posX = _mm256_add_epi32(centreX, _mm256_set1_epi32(offsetX));
+            __m256i inside = _mm256_and_si256(rowInside,
+                             _mm256_andnot_si256(_mm256_cmpgt_epi32(zero, posX), _mm256_cmpgt_epi32(columns, posX)));
+
+            // Byte offset of the tile, the shade is the low byte of the gathered word
+            __m256i offset = _mm256_slli_epi32(_mm256_add_epi32(rowStart, posX), 1);
+            __m256i tile = _mm256_mask_i32gather_epi32(zero, (const int *)grid, offset, inside, 1);
+            sum = _mm256_add_epi32(sum, _mm256_and_si256(tile, shadeMask));
+
+            // Map layers have a spare page at the end for the same 4 byte reads
+            if (attractMap.data != NULL)
+            {
+                __m256i value = _mm256_mask_i32gather_epi32(zero, (const int *)attractMap.data, _mm256_srli_epi32(offset, 1), inside, 1);
+                sum = _mm256_add_epi32(sum, _mm256_and_si256(value, shadeMask));
+            }
+        }
+    }
+
+    return _mm256_cvtepi32_ps(sum);
+}
+
+__attribute__((target("avx2")))
+__m256 Steer8(__m256 weightForward, __m256 weightLeft, __m256 weightRight, __m256 steeringStrength)
+{
+    __m256 one = _mm256_set1_ps(1.0f);
+
+    __m256 forward = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(weightForward, weightLeft, _CMP_GT_OQ),
+                                                 _mm256_cmp_ps(weightForward, weightRight, _CMP_GT_OQ)), one);
+    __m256 random = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(weightForward, weightLeft, _CMP_LT_OQ),
+                                                _mm256_cmp_ps(weightForward, weightRight, _CMP_LT_OQ)), one);
+    __m256 side = _mm256_sub_ps(_mm256_and_ps(_mm256_cmp_ps(weightLeft, weightRight, _CMP_GT_OQ), one),
+                                _mm256_and_ps(_mm256_cmp_ps(weightRight, weightLeft, _CMP_GT_OQ), one));
+
+    __m256 randomTurn = _mm256_mul_ps(_mm256_sub_ps(steeringStrength, _mm256_set1_ps(0.5f)), _mm256_set1_ps(2.0f));
+    __m256 sideTurn = _mm256_mul_ps(side, steeringStrength);
+
+    __m256 turn = _mm256_add_ps(_mm256_mul_ps(random, randomTurn), _mm256_mul_ps(_mm256_sub_ps(one, random), sideTurn));
+    return _mm256_mul_ps(_mm256_sub_ps(one, forward), turn);
+}
+
+__attribute__((target("avx2")))
+void AgentKernelAVX2(int start, int end, const float *strength, float deltaTime, float *newX, float *newY)
+{
+    __m256 dt = _mm256_set1_ps(deltaTime);
+    __m256 turnSpeed = _mm256_set1_ps(params.turnSpeed);
+
+    int i = start;
+    for (; i + 8 <= end; i += 8)
+    {
+        __m256 xPos = _mm256_loadu_ps(&agents.xPos[i]);
+        __m256 yPos = _mm256_loadu_ps(&agents.yPos[i]);
+        __m256 angle = _mm256_loadu_ps(&agents.angle[i]);
+        __m256 speed = _mm256_loadu_ps(&agents.speed[i]);
+
+        __m256 Xdirection, Ydirection;
+        SinCos8(angle, &Ydirection, &Xdirection);
+
+        _mm256_storeu_ps(&newX[i], _mm256_add_ps(xPos, _mm256_mul_ps(_mm256_mul_ps(Xdirection, speed), dt)));
+        _mm256_storeu_ps(&newY[i], _mm256_add_ps(yPos, _mm256_mul_ps(_mm256_mul_ps(Ydirection, speed), dt)));
+
+        __m256 weightForward = Sense8(xPos, yPos, angle, 0);
+        __m256 weightLeft = Sense8(xPos, yPos, angle, params.sensorScope);
+        __m256 weightRight = Sense8(xPos, yPos, angle, -params.sensorScope);
+
+        __m256 steer = Steer8(weightForward, weightLeft, weightRight, _mm256_loadu_ps(&strength[i]));
+        _mm256_storeu_ps(&agents.angle[i], _mm256_add_ps(angle, _mm256_mul_ps(_mm256_mul_ps(steer, turnSpeed), dt)));
+    }
+
+    // Leftover agents
+    AgentKernelScalar(i, end, strength, deltaTime, newX, newY);
+}
+
+#endif
+
+int CheckKernels()
+{
+    // Grid with some structure to sense
+    SeedRandom(1);
+    CreateGrid();
+    Spawn("random");
+    for (int step = 0; step < 20; step++)
+    {
+        Update(DEFAULT_DELTA_TIME);
+    }
+
+    static float angles[N_AGENTS], referenceX[N_AGENTS], referenceY[N_AGENTS], referenceAngles[N_AGENTS];
+    memcpy(angles, agents.angle, sizeof(angles));
+    for (int i = 0; i < N_AGENTS; i++)
+    {
+        steeringStrengths[i] = Rand01();
+    }
+
+    AgentKernelScalar(0, N_AGENTS, steeringStrengths, DEFAULT_DELTA_TIME, referenceX, referenceY);
+    memcpy(referenceAngles, agents.angle, sizeof(angles));
+
+    struct { const char *name; AgentKernel kernel; int supported; } kernels[] = {
+#if defined(__x86_64__) || defined(__i386__)
+        {"sse2", AgentKernelSSE, __builtin_cpu_supports("sse2")},
+        {"avx2", AgentKernelAVX2, __builtin_cpu_supports("avx2")},
+#endif
+        {"scalar", AgentKernelScalar, 1},
+    };
+
+    // Every lane has to agree with the scalar reference
+    int failed = 0;
+    for (int k = 0; k < (int)(sizeof(kernels)/sizeof(kernels[0])); k++)
+    {
+        if (!kernels[k].supported)
+        {
+            printf("%-6s not supported\n", kernels[k].name);
+            continue;
+        }
+
+        memcpy(agents.angle, angles, sizeof(angles));
+        kernels[k].kernel(0, N_AGENTS, steeringStrengths, DEFAULT_DELTA_TIME, newXPos, newYPos);
+
+        float maxError = 0;
+        for (int i = 0; i < N_AGENTS; i++)
+        {
+            maxError = MAX(maxError, fabsf(newXPos[i] - referenceX[i]));
+            maxError = MAX(maxError, fabsf(newYPos[i] - referenceY[i]));
+            maxError = MAX(maxError, fabsf(agents.angle[i] - referenceAngles[i]));
+        }
+
+        int ok = maxError <= 1e-4f;
+        failed += !ok;
+        printf("%-6s max error %g %s\n", kernels[k].name, maxError, ok ? "ok" : "FAILED");
+    }
+
+    return failed ? -1 : 0;
+}
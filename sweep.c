@@ -0,0 +1,296 @@
+#define _GNU_SOURCE         // For sched_setaffinity
+#include <stdlib.h>
+#include <string.h>         // For parsing sweep specs
+
+#include <unistd.h>         // For worker processes
+#include <sys/stat.h>
+#include <sys/wait.h>
+#ifdef __linux__
+#include <sched.h>          // For pinning workers to cores
+#endif
+
+#include "sim.h"
+
+
+// Sweep Values
+#define SWEEP_MAX_VALUES 16     // Values per swept parameter
+#define SWEEP_STEPS 1000
+
+typedef struct Sweep
+{
+    // Values for each field of Params
+    float values[PARAM_COUNT][SWEEP_MAX_VALUES];
+    int counts[PARAM_COUNT];
+
+    int steps;
+    double deltaTime;
+    unsigned int seed;
+    int workers;
+    char output[256];
+} Sweep;
+
+
+int ReadSweep(const char *path, Sweep *sweep)
+{
+    float *defaults = (float *)&params;
+
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+    {
+        printf("Could not open sweep spec %s\n", path);
+        return -1;
+    }
+
+    // Unswept parameters keep their default
+    for (int p = 0; p < PARAM_COUNT; p++)
+    {
+        sweep->values[p][0] = defaults[p];
+        sweep->counts[p] = 1;
+    }
+    sweep->steps = SWEEP_STEPS;
+    sweep->deltaTime = DEFAULT_DELTA_TIME;
+    sweep->seed = 1;
+    sweep->workers = sysconf(_SC_NPROCESSORS_ONLN);
+    strcpy(sweep->output, "sweep");
+
+    // One "name value value ..." per line, # starts a comment
+    char line[1024];
+    while (fgets(line, sizeof(line), file))
+    {
+        char *name = strtok(line, " \t\r\n");
+        if (name == NULL || name[0] == '#')
+        {
+            continue;
+        }
+
+        char *value = strtok(NULL, " \t\r\n");
+        if (value == NULL)
+        {
+            printf("Missing value for %s\n", name);
+            fclose(file);
+            return -1;
+        }
+
+        if (strcmp(name, "steps") == 0)             sweep->steps = atoi(value);
+        else if (strcmp(name, "delta_time") == 0)   sweep->deltaTime = atof(value);
+        else if (strcmp(name, "seed") == 0)         sweep->seed = strtoul(value, NULL, 10);
+        else if (strcmp(name, "workers") == 0)      sweep->workers = atoi(value);
+        else if (strcmp(name, "output") == 0)       snprintf(sweep->output, sizeof(sweep->output), "%s", value);
+        else
+        {
+            int p = FindParam(name);
+            if (p < 0)
+            {
+                printf("Unknown sweep parameter %s\n", name);
+                fclose(file);
+                return -1;
+            }
+
+            // Same limits as parameter files, one bad value stops the whole sweep
+            sweep->counts[p] = 0;
+            for (; value != NULL; value = strtok(NULL, " \t\r\n"))
+            {
+                if (sweep->counts[p] == SWEEP_MAX_VALUES)
+                {
+                    printf("More than %d values for sweep parameter %s\n", SWEEP_MAX_VALUES, name);
+                    fclose(file);
+                    return -1;
+                }
+
+                char *end;
+                float number = strtof(value, &end);
+                if (*end != '\0' || CheckParam(p, number) != 0)
+                {
+                    printf("Bad value %s for sweep parameter %s\n", value, name);
+                    fclose(file);
+                    return -1;
+                }
+                sweep->values[p][sweep->counts[p]++] = number;
+            }
+        }
+    }
+
+    fclose(file);
+    if (sweep->steps <= 0 || !(sweep->deltaTime > 0))
+    {
+        printf("Sweep needs steps and delta_time above 0\n");
+        return -1;
+    }
+
+    // Steps longer than one full blur would only be clamped by Blur, not simulated
+    int diffuse = FindParam("diffuse_speed");
+    for (int v = 0; v < sweep->counts[diffuse]; v++)
+    {
+        if (sweep->values[diffuse][v]*sweep->deltaTime > 1)
+        {
+            printf("delta_time %g is longer than one full blur at diffuse_speed %g\n", sweep->deltaTime, sweep->values[diffuse][v]);
+            return -1;
+        }
+    }
+    sweep->workers = MAX(1, sweep->workers);
+    return 0;
+}
+
+void SweepRun(Sweep *sweep, int run)
+{
+    // Run number to one value per parameter
+    float *runParams = (float *)&params;
+    int index = run;
+    for (int p = 0; p < PARAM_COUNT; p++)
+    {
+        runParams[p] = sweep->values[p][index % sweep->counts[p]];
+        index /= sweep->counts[p];
+    }
+
+    // Same seed for every run so only the parameters differ
+    SeedRandom(sweep->seed);
+    CreateGrid();
+    Spawn("circle");
+
+    uint64_t start = Ticks();
+    uint64_t collisions = 0;
+    for (int step = 0; step < sweep->steps; step++)
+    {
+        Update(sweep->deltaTime);
+        collisions += stats.collisions;
+        stats.collisions = 0;
+    }
+    double seconds = (double)(Ticks() - start)/TICKS_PER_SECOND;
+
+    char path[300];
+    snprintf(path, sizeof(path), "%s/run_%04d.ppm", sweep->output, run);
+    WriteImage(path);
+
+    // Summary line, collected by the parent when every run is done
+    snprintf(path, sizeof(path), "%s/run_%04d.csv", sweep->output, run);
+    FILE *file = fopen(path, "w");
+    if (file != NULL)
+    {
+        fprintf(file, "%d,%g,%g,%g,%g,%g,%.3f,%.0f,%llu,%d,%.3f\n",
+                run, params.turnSpeed, params.sensorScope, params.evaporateSpeed, params.diffuseSpeed, params.depositAmount,
+                seconds, (double)N_AGENTS*sweep->steps/seconds, (unsigned long long)collisions,
+                stats.activeTiles, stats.meanShade);
+        fclose(file);
+    }
+}
+
+int RunSweep(const char *path)
+{
+    Sweep sweep;
+    if (ReadSweep(path, &sweep) != 0)
+    {
+        return -1;
+    }
+
+    int runs = 1;
+    for (int p = 0; p < PARAM_COUNT; p++)
+    {
+        runs *= sweep.counts[p];
+    }
+
+    mkdir(sweep.output, 0755);
+
+    // Every run has the same footprint, so one worker per core pinned to it
+    // keeps each working set in its own core's caches
+    int cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int slots = MIN(sweep.workers, runs);
+    pid_t *pids = calloc(slots, sizeof(pid_t));
+    int running = 0;
+    int next = 0;
+    int failed = 0;
+
+    printf("Sweeping %d runs on %d workers\n", runs, slots);
+
+    while (next < runs || running > 0)
+    {
+        // Filling free worker slots
+        for (int w = 0; w < slots && next < runs; w++)
+        {
+            if (pids[w] != 0)
+            {
+                continue;
+            }
+
+            pid_t pid = fork();
+            if (pid == 0)
+            {
+#ifdef __linux__
+                cpu_set_t cpus;
+                CPU_ZERO(&cpus);
+                CPU_SET(w % MAX(1, cores), &cpus);
+                sched_setaffinity(0, sizeof(cpus), &cpus);
+#endif
+                SweepRun(&sweep, next);
+                _exit(0);
+            }
+
+            if (pid < 0)
+            {
+                printf("Could not start run %d\n", next);
+                failed++;
+            }
+            else
+            {
+                pids[w] = pid;
+                running++;
+            }
+            next++;
+        }
+
+        // Waiting for any run to finish
+        int status;
+        pid_t done = wait(&status);
+        if (done < 0)
+        {
+            break;
+        }
+
+        for (int w = 0; w < slots; w++)
+        {
+            if (pids[w] == done)
+            {
+                pids[w] = 0;
+                running--;
+            }
+        }
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        {
+            failed++;
+        }
+    }
+    free(pids);
+
+    // Collecting run summaries in run order
+    char summaryPath[300];
+    snprintf(summaryPath, sizeof(summaryPath), "%s/summary.csv", sweep.output);
+    FILE *summary = fopen(summaryPath, "w");
+    if (summary == NULL)
+    {
+        printf("Could not write %s\n", summaryPath);
+        return -1;
+    }
+    fprintf(summary, "run,turn_speed,sensor_scope,evaporate_speed,diffuse_speed,deposit_amount,seconds,agent_steps_per_sec,collisions,active_tiles,mean_shade\n");
+    for (int run = 0; run < runs; run++)
+    {
+        char path[300];
+        snprintf(path, sizeof(path), "%s/run_%04d.csv", sweep.output, run);
+        FILE *file = fopen(path, "r");
+        if (file == NULL)
+        {
+            failed++;
+            continue;
+        }
+
+        char line[512];
+        if (fgets(line, sizeof(line), file))
+        {
+            fputs(line, summary);
+        }
+        fclose(file);
+        remove(path);
+    }
+    fclose(summary);
+
+    printf("Sweep done, %d failed, results in %s\n", failed, sweep.output);
+    return failed ? -1 : 0;
+}